@@ -0,0 +1,58 @@
+/**
+ * @file alarms.hpp
+ * @author melektron
+ * @brief battery alarm evaluation based on the threshold settings
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rule_engine.hpp"
+#include "settings.hpp"
+#include "env.hpp"
+
+namespace alarms
+{
+    // layout of the input values: the cell voltages (lowest cell first)
+    // followed by the cell spread
+    constexpr size_t SPREAD_INPUT = env::NR_OF_CELLS;
+    constexpr size_t NR_OF_INPUTS = env::NR_OF_CELLS + 1;
+
+    // warning and alarm rule per cell plus the spread rule
+    constexpr size_t NR_OF_RULES = env::NR_OF_CELLS * 2 + 1;
+
+    /**
+     * @brief builds the alarm rule table (see evaluate()) from the threshold,
+     * hysteresis and debounce settings
+     *
+     * @param _config settings to build the rules from
+     * @param _rules table to write the rules to
+     */
+    void make_rules(const settings::snapshot_t &_config, rule_t (&_rules)[NR_OF_RULES]);
+
+    /**
+     * @brief compiles the alarm rules from the current settings.
+     * Must be called after settings::init().
+     */
+    void init();
+
+    /**
+     * @brief evaluates all alarm rules (warning and alarm voltage per cell, maximum
+     * cell spread) with hysteresis and debounce. The rules are recompiled 
+     * automatically when settings change.
+     * The debounce counts calls of this function, i.e. monitoring cycles. These
+     * are at least MONITOR_MIN_INTERVAL apart (see scheduler::wake_delay()),
+     * so a debounce of n holds a rule for at least (n - 1) times that interval.
+     * 
+     * @param _inputs cell voltages and cell spread in mV (see SPREAD_INPUT)
+     * @return severity_t highest severity of all active rules
+     */
+    severity_t evaluate(const int32_t (&_inputs)[NR_OF_INPUTS]);
+} // namespace alarms
@@ -0,0 +1,124 @@
+/**
+ * @file backlog.hpp
+ * @author melektron
+ * @brief crash safe flash storage for samples that couldn't be sent yet
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <el/retcode.hpp>
+
+#include "net.hpp"
+
+namespace backlog
+{
+    /**
+     * @brief position in the backlog used to read samples without
+     * removing them (see read() and consume())
+     */
+    struct cursor_t
+    {
+        size_t sector;  // index of the sector in the partition
+        size_t slot;    // index of the record in the sector
+        size_t passed;  // number of pending records passed since begin()
+    };
+
+    /**
+     * @brief counters describing the state of the backlog
+     */
+    struct stats_t
+    {
+        uint32_t pending;   // samples stored and not uploaded yet
+        uint32_t stored;    // samples stored since boot
+        uint32_t dropped;   // samples overwritten because the backlog was full
+        uint32_t capacity;  // maximum number of samples that can be stored
+    };
+
+    /**
+     * @brief opens the "backlog" data partition and recovers the stored
+     * samples (including ones stored before a crash or power loss) and
+     * increments the boot number. Must be called after settings::init()
+     * (which initializes NVS).
+     * If the partition doesn't exist, the backlog stays empty and push()
+     * fails, everything else keeps working.
+     *
+     * The partition is used as ring of sectors. Each sector starts with a header
+     * containing a sequence number (so the oldest and newest sector can be found
+     * after a reboot) followed by fixed size records. Every record has a CRC, so
+     * a record that was only partially written is detected and skipped.
+     * Uploaded records are marked by clearing a flag word (which doesn't need an
+     * erase) and sectors are erased once all their records were uploaded. If the
+     * device resets between uploading and marking, the samples are uploaded
+     * again, the server can detect this by the boot number and timestamp.
+     *
+     * Calling it again recovers the state from flash, as after a reboot.
+     *
+     * All other functions may only be called by one task (the networking task)
+     * after init() returned.
+     * The sampling path never accesses the backlog. Flash writes and erases
+     * disable the cache of both cores though, so the ADC driver interrupt runs
+     * from IRAM (CONFIG_ADC_CONTINUOUS_ISR_IRAM_SAFE) and keeps filling its
+     * pool while the sampling task is stalled.
+     */
+    el::retcode init();
+
+    /**
+     * @return uint32_t number of the current boot (incremented on every
+     * boot, persists in NVS). Timestamps are relative to the boot, so
+     * together they identify samples from earlier boots in the backlog.
+     */
+    uint32_t get_boot_number();
+
+    /**
+     * @brief stores a sample at the end of the backlog. If the backlog is full,
+     * the oldest sector of samples is dropped to make room.
+     *
+     * @param _sample the sample to store
+     * @retval ok - the sample was written to flash
+     * @retval err - there is no backlog partition or writing failed
+     */
+    el::retcode push(const net::sample_t &_sample);
+
+    /**
+     * @return size_t number of samples stored and not uploaded yet
+     */
+    size_t size();
+
+    /**
+     * @return cursor_t cursor pointing to the oldest sample not uploaded yet
+     */
+    cursor_t begin();
+
+    /**
+     * @brief reads the sample at the cursor and advances the cursor to
+     * the next one. The sample stays in the backlog until consume() is called.
+     * Corrupted records are skipped.
+     *
+     * @param _cursor cursor from begin() or a previous read()
+     * @param _sample the sample to write to
+     * @return true - a sample was read
+     * @return false - there are no more samples
+     */
+    bool read(cursor_t &_cursor, net::sample_t &_sample);
+
+    /**
+     * @brief removes all samples before the cursor from the backlog,
+     * e.g. after they were uploaded successfully. No samples may be pushed
+     * between begin() and consume().
+     *
+     * @param _end cursor returned by begin() and advanced by read()
+     */
+    void consume(const cursor_t &_end);
+
+    /**
+     * @return stats_t the current backlog counters
+     */
+    stats_t get_stats();
+};
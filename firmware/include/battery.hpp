@@ -11,15 +11,94 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "env.hpp"
+
 namespace battery
 {
+    // number of cells of the pack (see env::CELL_INPUTS)
+    constexpr size_t NR_OF_CELLS = env::NR_OF_CELLS;
+
+    /**
+     * @brief starts the continuous ADC conversion and the sampling
+     * task that averages the results. Blocks until the first
+     * averaged values of all cells are available.
+     * Must be called after env::init_adc().
+     */
+    void init();
+
+    /**
+     * @brief returns the latest averaged value produced by the sampling
+     * task. This doesn't do any ADC conversions itself and returns immediately.
+     * 
+     * @param _cell index of the cell (0 = lowest cell)
+     * @return int voltage of the cell in mV
+     */
+    int read_cell(size_t _cell);
+
+    /**
+     * @brief returns the averaged voltage difference between the highest
+     * and the lowest cell. Unlike comparing the results of read_cell(), this 
+     * is calculated from the samples of one scan over all cells, which are 
+     * converted directly after each other, so load pulses affect all
+     * cells equally and don't cause false differences.
+     * 
+     * @return int voltage of the highest minus voltage of the lowest cell in mV
+     */
+    int read_cell_spread();
+
+    /**
+     * @brief returns the output of the low pass filter that is updated with
+     * every sample of a cell (see settings::FILTER_TIME_CONSTANT).
+     * All consumers that make decisions based on the cell voltage should
+     * use the filtered values, so they all see the same, consistent voltage.
+     * This is lock-free and returns immediately.
+     * 
+     * @param _cell index of the cell (0 = lowest cell)
+     * @return int filtered voltage of the cell in mV
+     */
+    int read_filtered_cell(size_t _cell);
+
+    /**
+     * @brief low pass filtered version of read_cell_spread()
+     * 
+     * @return int filtered voltage of the highest minus voltage of the lowest cell in mV
+     */
+    int read_filtered_cell_spread();
+
+    /**
+     * @brief predicts how long it will take until a cell reaches its alarm
+     * voltage (settings::CELL_ALARM_VOLTAGE) by extrapolating the trend of
+     * the filtered cell voltage over the last few minutes.
+     * 
+     * @param _cell index of the cell (0 = lowest cell)
+     * @return int32_t remaining time in seconds, 0 if the alarm voltage is
+     * already reached or -1 if unknown (not discharging or not enough data yet)
+     */
+    int32_t predict_cell_runtime(size_t _cell);
+
     /**
-     * @return int voltage of cell 1 (lower cell) in mV
+     * @brief the sampling task averages only as many samples as are needed to
+     * reach the configured confidence bound (see settings::SAMPLING_CONFIDENCE_BOUND).
+     * 
+     * @param _cell index of the cell (0 = lowest cell)
+     * @return uint32_t number of samples that were averaged for the
+     * latest value of the cell
      */
-    int read_cell1();
+    uint32_t get_cell_sample_count(size_t _cell);
 
     /**
-     * @return int voltage of cell 2 (lower cell) in mV
+     * @brief registers a task that is notified (xTaskNotifyGive) by the sampling
+     * task whenever the filtered voltage of a cell crosses its warning or alarm
+     * threshold or the cell spread crosses its alarm threshold, in either direction.
+     * This allows the task to sleep long while the pack is healthy
+     * and still react immediately.
+     * 
+     * @param _task the task to notify (nullptr to stop notifications)
      */
-    int read_cell2();
-}
\ No newline at end of file
+    void notify_on_threshold_crossing(TaskHandle_t _task);
+}
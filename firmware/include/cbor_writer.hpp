@@ -0,0 +1,196 @@
+/**
+ * @file cbor_writer.hpp
+ * @author melektron
+ * @brief streaming CBOR (RFC 8949) writer into a fixed buffer
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+namespace net
+{
+    /**
+     * @brief writes CBOR directly into a caller provided buffer without any
+     * heap allocation. It has the same interface as json_writer, so the same
+     * code can produce either encoding.
+     * Objects and arrays are written with indefinite length (terminated by a
+     * break byte), so the number of members doesn't have to be known in advance.
+     * Integers use the shortest possible encoding.
+     * If the buffer is too small, writing stops and ok() returns false.
+     */
+    class cbor_writer
+    {
+        // CBOR major types
+        enum major_t : uint8_t
+        {
+            UNSIGNED_INT = 0,
+            NEGATIVE_INT = 1,
+            TEXT_STRING = 3,
+            ARRAY = 4,
+            MAP = 5,
+        };
+        // additional information for indefinite length items
+        static constexpr uint8_t INDEFINITE = 31;
+        static constexpr uint8_t BREAK = 0xff;
+
+        uint8_t *buffer;
+        size_t capacity;
+        size_t length = 0;
+        bool overflow = false;
+
+        void put(uint8_t _byte)
+        {
+            if (length >= capacity)
+            {
+                overflow = true;
+                return;
+            }
+            buffer[length++] = _byte;
+        }
+
+        /**
+         * @brief writes the initial byte(s) of a data item
+         */
+        void head(major_t _major, uint64_t _argument)
+        {
+            uint8_t major = _major << 5;
+            if (_argument < 24)
+            {
+                put(major | _argument);
+                return;
+            }
+
+            // 1, 2, 4 or 8 following bytes (big endian)
+            int bytes = 8;
+            uint8_t info = 27;
+            if (_argument <= UINT8_MAX)
+                bytes = 1, info = 24;
+            else if (_argument <= UINT16_MAX)
+                bytes = 2, info = 25;
+            else if (_argument <= UINT32_MAX)
+                bytes = 4, info = 26;
+
+            put(major | info);
+            for (int i = bytes - 1; i >= 0; i--)
+                put((_argument >> (i * 8)) & 0xff);
+        }
+
+    public:
+        /**
+         * @param _buffer where to write the data to
+         * @param _capacity size of the buffer
+         */
+        cbor_writer(uint8_t *_buffer, size_t _capacity)
+            : buffer(_buffer)
+            , capacity(_capacity)
+        {}
+
+        cbor_writer &begin_object()
+        {
+            put((MAP << 5) | INDEFINITE);
+            return *this;
+        }
+
+        cbor_writer &end_object()
+        {
+            put(BREAK);
+            return *this;
+        }
+
+        cbor_writer &begin_array()
+        {
+            put((ARRAY << 5) | INDEFINITE);
+            return *this;
+        }
+
+        cbor_writer &end_array()
+        {
+            put(BREAK);
+            return *this;
+        }
+
+        /**
+         * @brief writes the key of the next object member as text string
+         */
+        cbor_writer &key(const char *_key)
+        {
+            size_t key_length = 0;
+            while (_key[key_length] != 0)
+                key_length++;
+
+            head(TEXT_STRING, key_length);
+            for (size_t i = 0; i < key_length; i++)
+                put(_key[i]);
+            return *this;
+        }
+
+        /**
+         * @brief writes an integer value (member value or array element)
+         */
+        template <typename T>
+        cbor_writer &value(T _value)
+        {
+            static_assert(std::is_integral<T>::value, "only integer values are supported");
+            if constexpr (std::is_signed<T>::value)
+            {
+                // negative integers are encoded as -1 - n
+                if (_value < 0)
+                {
+                    head(NEGATIVE_INT, ~(uint64_t)(int64_t)_value);
+                    return *this;
+                }
+            }
+            head(UNSIGNED_INT, (uint64_t)_value);
+            return *this;
+        }
+
+        /**
+         * @brief writes an object member with an integer value
+         */
+        template <typename T>
+        cbor_writer &field(const char *_key, T _value)
+        {
+            return key(_key).value(_value);
+        }
+
+        /**
+         * @return true if everything fit into the buffer
+         */
+        bool ok() const
+        {
+            return !overflow;
+        }
+
+        /**
+         * @return const char* the data written so far
+         */
+        const char *data() const
+        {
+            return (const char *)buffer;
+        }
+
+        /**
+         * @return size_t number of bytes written so far
+         */
+        size_t size() const
+        {
+            return length;
+        }
+
+        /**
+         * @return size_t number of bytes that can still be written
+         */
+        size_t remaining() const
+        {
+            return overflow ? 0 : capacity - length;
+        }
+    };
+};
@@ -0,0 +1,189 @@
+/**
+ * @file cell_array.hpp
+ * @author melektron
+ * @brief measurement processing chain for all cells of a pack
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "sequential_estimator.hpp"
+#include "iir_filter.hpp"
+#include "runtime_predictor.hpp"
+
+namespace battery
+{
+    /**
+     * @brief holds the processing stages (averaging, filtering, runtime prediction)
+     * of N cells and publishes their results so they can be read lock-free
+     * from other tasks.
+     * Samples are expected in scan order (cell 0 to N-1, repeating), as produced
+     * by the ADC conversion pattern. Each complete scan is also used to
+     * calculate the time aligned spread (highest minus lowest cell voltage).
+     * This doesn't depend on any hardware so it can be fed with recorded
+     * sample streams as well.
+     *
+     * @tparam N number of cells
+     * @tparam RUNTIME_WINDOW window size of the runtime predictors in samples
+     */
+    template <size_t N, size_t RUNTIME_WINDOW>
+    class cell_array
+    {
+        static_assert(N >= 1, "a pack needs at least one cell");
+
+        // processing stages and published results of one cell
+        struct cell_t
+        {
+            sequential_estimator estimator;
+            iir_filter filter;
+            runtime_predictor<RUNTIME_WINDOW> predictor;
+
+            // published results
+            std::atomic<int> average{0};
+            std::atomic<uint32_t> sample_count{0};
+            std::atomic<uint32_t> average_count{0};
+            std::atomic<int> filtered{0};
+            std::atomic<int32_t> runtime{-1};
+        };
+        cell_t cells[N];
+
+        // processing stages and published results of the cell spread
+        sequential_estimator spread_estimator;
+        iir_filter spread_filter;
+        std::atomic<int> spread_average{0};
+        std::atomic<int> spread_filtered{0};
+
+        // state of the current scan (0 = waiting for the first cell)
+        size_t scan_next = 0;
+        int scan_min = 0;
+        int scan_max = 0;
+
+    public:
+        /**
+         * @brief applies the averaging parameters to all estimators
+         * (see sequential_estimator::configure())
+         */
+        void configure_estimators(uint32_t _min_samples, uint32_t _max_samples, int _bound)
+        {
+            for (cell_t &cell : cells)
+                cell.estimator.configure(_min_samples, _max_samples, _bound);
+            spread_estimator.configure(_min_samples, _max_samples, _bound);
+        }
+
+        /**
+         * @brief applies the filter parameters to all filters
+         * (see iir_filter::configure())
+         */
+        void configure_filters(int _time_constant_ms, int _sample_period_us)
+        {
+            for (cell_t &cell : cells)
+                cell.filter.configure(_time_constant_ms, _sample_period_us);
+            spread_filter.configure(_time_constant_ms, _sample_period_us);
+        }
+
+        /**
+         * @brief feeds a sample of a cell through the processing stages
+         *
+         * @param _cell index of the cell
+         * @param _voltage cell voltage in mV
+         */
+        void add_sample(size_t _cell, int _voltage)
+        {
+            cell_t &cell = cells[_cell];
+
+            cell.filter.update(_voltage);
+            cell.filtered.store(cell.filter.value(), std::memory_order_relaxed);
+
+            if (cell.estimator.add(_voltage))
+            {
+                cell.average.store(cell.estimator.result(), std::memory_order_relaxed);
+                cell.sample_count.store(cell.estimator.result_count(), std::memory_order_relaxed);
+                cell.average_count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // track the scan, any sample out of order discards it
+            if (_cell == 0)
+            {
+                scan_min = scan_max = _voltage;
+                scan_next = 1;
+            }
+            else if (_cell == scan_next)
+            {
+                scan_min = _voltage < scan_min ? _voltage : scan_min;
+                scan_max = _voltage > scan_max ? _voltage : scan_max;
+                scan_next++;
+            }
+            else
+            {
+                scan_next = 0;
+            }
+
+            // the samples of a scan are only one conversion apart each and see
+            // the same load conditions, so their spread isn't affected by load pulses
+            if (scan_next == N)
+            {
+                scan_next = 0;
+                int spread = scan_max - scan_min;
+                spread_filter.update(spread);
+                spread_filtered.store(spread_filter.value(), std::memory_order_relaxed);
+                if (spread_estimator.add(spread))
+                    spread_average.store(spread_estimator.result(), std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief discards the scan in progress. Must be called when samples
+         * were lost (read errors, DMA overruns), otherwise samples from before
+         * and after the gap could be combined into one scan.
+         */
+        void reset_scan()
+        {
+            scan_next = 0;
+        }
+
+        /**
+         * @brief feeds the current filtered voltage of a cell to its runtime
+         * predictor and publishes the new prediction. Must be called periodically.
+         *
+         * @param _cell index of the cell
+         * @param _threshold voltage (mV) to predict the time until
+         * @param _period_s period in which this is called in seconds
+         */
+        void update_runtime(size_t _cell, int _threshold, int _period_s)
+        {
+            cell_t &cell = cells[_cell];
+            cell.predictor.add(cell.filter.value());
+            int32_t samples = cell.predictor.samples_until(_threshold);
+            int32_t runtime = samples < 0 ? -1 :
+                (samples > INT32_MAX / _period_s ? INT32_MAX / _period_s : samples) * _period_s;
+            cell.runtime.store(runtime, std::memory_order_relaxed);
+        }
+
+        /**
+         * @return true if every cell has published at least one average
+         */
+        bool ready() const
+        {
+            for (const cell_t &cell : cells)
+                if (cell.average_count.load(std::memory_order_relaxed) == 0)
+                    return false;
+            return true;
+        }
+
+        // lock-free readers of the published results (see battery.hpp)
+        int average(size_t _cell) const { return cells[_cell].average.load(std::memory_order_relaxed); }
+        uint32_t sample_count(size_t _cell) const { return cells[_cell].sample_count.load(std::memory_order_relaxed); }
+        int filtered(size_t _cell) const { return cells[_cell].filtered.load(std::memory_order_relaxed); }
+        int32_t runtime(size_t _cell) const { return cells[_cell].runtime.load(std::memory_order_relaxed); }
+        int average_spread() const { return spread_average.load(std::memory_order_relaxed); }
+        int filtered_spread() const { return spread_filtered.load(std::memory_order_relaxed); }
+    };
+} // namespace battery
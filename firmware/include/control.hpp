@@ -0,0 +1,42 @@
+/**
+ * @file control.hpp
+ * @author melektron
+ * @brief downlink for server driven configuration
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <el/retcode.hpp>
+
+namespace control
+{
+    /**
+     * @brief applies a control message received from the server
+     * (in the response to a report). The message is a JSON object that
+     * may contain a "settings" object mapping setting names (NVS names, see
+     * settings::get_json_schema()) to new values, e.g.:
+     *
+     *     {"settings": {"c1_warn_v": 3100, "mon_max_ms": 10000, "smpl_max": 256}}
+     *
+     * This covers thresholds, the report cadence (monitoring interval and
+     * upload batching, see settings::REPORT_BATCH_SIZE) and the
+     * sampling mode. Other members are ignored, so the server can add more later.
+     * The message is parsed directly from the buffer without building a DOM,
+     * and all valid values are applied in one settings transaction. Nothing
+     * is applied if the message is malformed or the resulting settings
+     * are inconsistent (see settings::transaction::commit()).
+     * Unknown settings and invalid values are skipped.
+     *
+     * @param _data message text (doesn't need to be null terminated)
+     * @param _length length of the message in bytes
+     * @retval ok - message was applied (or empty)
+     * @retval err - message is not valid JSON or its settings are inconsistent
+     */
+    el::retcode apply_message(const char *_data, size_t _length);
+};
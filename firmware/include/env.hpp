@@ -11,8 +11,12 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <atomic>
 #include <driver/gpio.h>
-#include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_continuous.h>
 #include <esp_adc/adc_cali.h>
 
 namespace env
@@ -24,14 +28,100 @@ namespace env
     // GPIO Inputs
     extern const gpio_num_t WRONG_C1I;
     extern const gpio_num_t WRONG_C2I;
-    extern const gpio_num_t C1I;
-    extern const gpio_num_t C2I;
+
+    // description of an analog input measuring one cell of the pack
+    struct cell_input_t
+    {
+        gpio_num_t gpio;
+        adc_channel_t channel;  // ADC1 channel of the GPIO (checked in init_adc())
+        int divider_ratio;      // ratio of the voltage divider in front of the input
+    };
+
+    // analog inputs of all cells, lowest cell first. For packs with
+    // more cells, add the inputs here (max. 8, all must be on ADC1),
+    // everything else is derived from this table.
+    constexpr cell_input_t CELL_INPUTS[] = {
+        {GPIO_NUM_35, ADC_CHANNEL_7, 3},    // C1I
+        {GPIO_NUM_34, ADC_CHANNEL_6, 3},    // C2I
+    };
+    constexpr size_t NR_OF_CELLS = sizeof(CELL_INPUTS) / sizeof(CELL_INPUTS[0]);
+    static_assert(NR_OF_CELLS >= 1 && NR_OF_CELLS <= 8, "ADC1 supports 1 to 8 cell inputs");
+
+    // number of channel numbers that can appear in a conversion result (4 bit field)
+    constexpr size_t ADC_CHANNEL_SLOTS = 16;
+
+    /**
+     * @brief generates the table mapping ADC channels to cell indices
+     * 
+     * @return table where entry c is the index of the cell measured by
+     * channel c, or -1 if the channel doesn't measure a cell
+     */
+    constexpr std::array<int8_t, ADC_CHANNEL_SLOTS> generate_channel_to_cell()
+    {
+        std::array<int8_t, ADC_CHANNEL_SLOTS> table{};
+        for (size_t channel = 0; channel < ADC_CHANNEL_SLOTS; channel++)
+            table[channel] = -1;
+        for (size_t cell = 0; cell < NR_OF_CELLS; cell++)
+            table[CELL_INPUTS[cell].channel] = cell;
+        return table;
+    }
+    constexpr std::array<int8_t, ADC_CHANNEL_SLOTS> CHANNEL_TO_CELL = generate_channel_to_cell();
 
     // ADC handles (all on unit ADC1, only use after gpio init)
-    extern adc_oneshot_unit_handle_t adc1_handle;
+    extern adc_continuous_handle_t adc1_handle;
     extern adc_cali_handle_t adc1_calibration_handle;
-    extern adc_channel_t c1i_adc_channel;
-    extern adc_channel_t c2i_adc_channel;
+
+    // total conversion rate of ADC1 (shared between all channels in the pattern).
+    // 20 kHz is the lowest rate supported by the ESP32 DMA mode.
+    constexpr int ADC1_SAMPLE_FREQ_HZ = 20000;
+    // resulting sample rate of each cell input (one channel per cell in the pattern)
+    constexpr int CELL_SAMPLE_FREQ_HZ = ADC1_SAMPLE_FREQ_HZ / NR_OF_CELLS;
+
+    // time between two conversions of ADC1 and between two samples of the
+    // same cell. Unlike CELL_SAMPLE_FREQ_HZ these are exact for any number of cells.
+    constexpr int ADC1_CONVERSION_PERIOD_US = 1000000 / ADC1_SAMPLE_FREQ_HZ;
+    static_assert(1000000 % ADC1_SAMPLE_FREQ_HZ == 0, "ADC1 conversion period must be a whole number of us");
+    constexpr int CELL_SAMPLE_PERIOD_US = ADC1_CONVERSION_PERIOD_US * NR_OF_CELLS;
+
+    // number of conversion results in one DMA frame. The ADC driver
+    // interrupt hands out one frame at a time.
+    constexpr int ADC1_FRAME_RESULTS = 512;
+    constexpr int ADC1_FRAME_PERIOD_US = ADC1_CONVERSION_PERIOD_US * ADC1_FRAME_RESULTS;
+
+    // number of entries in the ADC lookup tables (covers the full 12 bit range)
+    constexpr size_t ADC_LUT_SIZE = 4096;
+
+    // lookup tables mapping raw ADC values of the cell inputs directly
+    // to the cell voltage in mV (calibration, divider ratio and
+    // correction factor included), one per cell
+    typedef uint16_t cell_voltage_lut_t[NR_OF_CELLS][ADC_LUT_SIZE];
+
+    // the current lookup tables. update_adc_lut() builds new tables in a
+    // second buffer and then swaps this pointer, so a reader always sees one
+    // complete set. Load it once per DMA frame and keep using that set for
+    // the whole frame (acquire order).
+    extern std::atomic<const cell_voltage_lut_t *> cell_voltage_lut;
+
+    // denominator of the voltage correction settings (10000 = factor 1.0)
+    constexpr int VOLTAGE_CORRECTION_ONE = 10000;
+
+    /**
+     * @brief calculates one entry of the voltage lookup tables
+     *
+     * @param _adc_voltage calibrated voltage at the ADC input in mV
+     * @param _divider_ratio ratio of the voltage divider in front of the input
+     * @param _correction correction factor in 1/VOLTAGE_CORRECTION_ONE
+     * @return uint16_t cell voltage in mV, rounded to the nearest mV and
+     * clamped to the range of a table entry (0 to 65535 mV)
+     */
+    constexpr uint16_t cell_voltage_from_adc(int _adc_voltage, int _divider_ratio, int _correction)
+    {
+        int64_t scaled = (int64_t)_adc_voltage * _divider_ratio * _correction;
+        if (scaled <= 0)
+            return 0;
+        int64_t voltage = (scaled + VOLTAGE_CORRECTION_ONE / 2) / VOLTAGE_CORRECTION_ONE;
+        return voltage > UINT16_MAX ? UINT16_MAX : (uint16_t)voltage;
+    }
 
     /**
      * @brief configures the GPIO pins
@@ -40,9 +130,25 @@ namespace env
     void init_gpio();
 
     /**
-     * @brief initializes the ADC and the channel
-     * config variables c1i_adc_channel and c2i_adc_channel
+     * @brief initializes the ADC in continuous (DMA) mode,
+     * configuring a conversion pattern that converts all
+     * cell inputs one after the other.
+     * The conversion is not started here, that is done by battery::init().
+     * This also builds the voltage lookup tables and subscribes to the
+     * correction settings to rebuild them on change.
+     * Must be called after settings::init().
      * 
      */
     void init_adc();
+
+    /**
+     * @brief (re)builds the voltage lookup tables cell_voltage_lut
+     * from the ADC calibration and the voltage correction settings.
+     * This is called automatically (on the settings task) when the correction
+     * settings change. The sampling task keeps using the old tables until the
+     * new ones are complete. After the swap this waits until the sampling task
+     * is done with the old tables, so the next call can reuse their buffer.
+     * 
+     */
+    void update_adc_lut();
 };
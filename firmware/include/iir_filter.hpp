@@ -0,0 +1,104 @@
+/**
+ * @file iir_filter.hpp
+ * @author melektron
+ * @brief fixed point first order IIR (exponential moving average) filter
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+namespace battery
+{
+    /**
+     * @brief first order low pass filter y += alpha * (x - y), updated
+     * once per input sample. The state and alpha are kept in Q32 fixed point.
+     * With long time constants alpha * (x - y) is tiny (alpha ~ 1e-8 at 1 h
+     * and 10 kHz), so fewer fractional bits in the state would make it stop
+     * short of the input (dead band).
+     * This doesn't depend on any hardware so it can be fed with recorded
+     * sample streams as well.
+     */
+    class iir_filter
+    {
+        static constexpr int64_t Q32_ONE = (int64_t)1 << 32;
+
+        // filter output in Q32 (value << 32)
+        int64_t state_q32 = 0;
+        // filter coefficient in Q32 (Q32_ONE = no filtering)
+        int64_t alpha_q32 = Q32_ONE;
+        bool initialized = false;
+
+        int time_constant_ms = 0;
+        int sample_period_us = 0;
+
+    public:
+        /**
+         * @brief sets the filter time constant. This is only recalculated if
+         * the parameters changed, so it is cheap to call periodically.
+         *
+         * @param _time_constant_ms time constant of the filter in ms (0 disables filtering)
+         * @param _sample_period_us time between two samples in us
+         */
+        void configure(int _time_constant_ms, int _sample_period_us)
+        {
+            if (_time_constant_ms == time_constant_ms && _sample_period_us == sample_period_us)
+                return;
+            time_constant_ms = _time_constant_ms;
+            sample_period_us = _sample_period_us;
+
+            if (_time_constant_ms <= 0)
+            {
+                alpha_q32 = Q32_ONE;
+                return;
+            }
+
+            // exact discretization of the continuous time constant
+            double alpha = 1.0 - exp(-(double)_sample_period_us / (_time_constant_ms * 1000.0));
+            alpha_q32 = (int64_t)(alpha * 4294967296.0 + 0.5);
+            if (alpha_q32 < 1)
+                alpha_q32 = 1;
+            if (alpha_q32 > Q32_ONE)
+                alpha_q32 = Q32_ONE;
+        }
+
+        /**
+         * @brief feeds one sample into the filter. The very first sample
+         * initializes the state directly so there is no start up ramp.
+         *
+         * @param _sample the input value
+         */
+        void update(int _sample)
+        {
+            int64_t sample_q32 = (int64_t)_sample * Q32_ONE;
+            if (!initialized || alpha_q32 == Q32_ONE)
+            {
+                state_q32 = sample_q32;
+                initialized = true;
+                return;
+            }
+
+            // alpha * (x - y) needs up to 80 bits, so the difference is split
+            // into its integer part (floor) and its fractional part, which
+            // are multiplied separately. Both products fit into 64 bits.
+            int64_t diff = sample_q32 - state_q32;
+            int64_t diff_int = diff >> 32;
+            uint64_t diff_frac = (uint64_t)diff & 0xffffffffu;
+            state_q32 += diff_int * alpha_q32 + (int64_t)((diff_frac * (uint64_t)alpha_q32) >> 32);
+        }
+
+        /**
+         * @return int current filter output (rounded)
+         */
+        int value() const
+        {
+            return (int)((state_q32 + Q32_ONE / 2) >> 32);
+        }
+    };
+} // namespace battery
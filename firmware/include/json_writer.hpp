@@ -0,0 +1,243 @@
+/**
+ * @file json_writer.hpp
+ * @author melektron
+ * @brief streaming JSON writer into a fixed buffer
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+namespace net
+{
+    /**
+     * @brief writes JSON text directly into a caller provided buffer without
+     * any heap allocation. Commas between members and elements are inserted
+     * automatically. Only integer values and keys that don't need escaping
+     * are supported, which is all the reports need.
+     * If the buffer is too small, writing stops and ok() returns false, the
+     * text is always null terminated.
+     *
+     * Example:
+     *     writer.begin_object().field("voltage", 3700).key("cells").begin_array()...
+     */
+    class json_writer
+    {
+        // maximum nesting depth of objects and arrays
+        static constexpr int MAX_DEPTH = 32;
+
+        char *buffer;
+        size_t capacity;
+        size_t length = 0;
+        bool overflow = false;
+
+        // nesting depth and one bit per level that is set
+        // until the first element of that level was written
+        int depth = 0;
+        uint32_t first_element = 0;
+        // whether a key was just written (so the value needs no comma)
+        bool after_key = false;
+
+        void put(char _c)
+        {
+            if (length + 1 >= capacity)
+            {
+                overflow = true;
+                return;
+            }
+            buffer[length++] = _c;
+            buffer[length] = 0;
+        }
+
+        void put(const char *_text)
+        {
+            for (; *_text != 0; _text++)
+                put(*_text);
+        }
+
+        /**
+         * @brief writes a comma if this is not the first element
+         * of the current level
+         */
+        void separate()
+        {
+            if (after_key)
+            {
+                after_key = false;
+                return;
+            }
+            if (depth == 0)
+                return;
+            uint32_t bit = 1ul << (depth - 1);
+            if (first_element & bit)
+                first_element &= ~bit;
+            else
+                put(',');
+        }
+
+        void open(char _bracket)
+        {
+            separate();
+            put(_bracket);
+            if (depth >= MAX_DEPTH)
+            {
+                overflow = true;
+                return;
+            }
+            depth++;
+            first_element |= 1ul << (depth - 1);
+        }
+
+        void close(char _bracket)
+        {
+            if (depth > 0)
+                depth--;
+            put(_bracket);
+        }
+
+    public:
+        /**
+         * @param _buffer where to write the text to
+         * @param _capacity size of the buffer (including null terminator)
+         */
+        json_writer(char *_buffer, size_t _capacity)
+            : buffer(_buffer)
+            , capacity(_capacity)
+        {
+            if (capacity > 0)
+                buffer[0] = 0;
+            else
+                overflow = true;
+        }
+
+        json_writer &begin_object()
+        {
+            open('{');
+            return *this;
+        }
+
+        json_writer &end_object()
+        {
+            close('}');
+            return *this;
+        }
+
+        json_writer &begin_array()
+        {
+            open('[');
+            return *this;
+        }
+
+        json_writer &end_array()
+        {
+            close(']');
+            return *this;
+        }
+
+        /**
+         * @brief writes the key of the next object member
+         *
+         * @param _key the key (must not contain characters that need escaping)
+         */
+        json_writer &key(const char *_key)
+        {
+            separate();
+            put('"');
+            put(_key);
+            put('"');
+            put(':');
+            after_key = true;
+            return *this;
+        }
+
+        /**
+         * @brief writes an integer value (member value or array element)
+         */
+        template <typename T>
+        json_writer &value(T _value)
+        {
+            static_assert(std::is_integral<T>::value, "only integer values are supported");
+            separate();
+
+            // convert using unsigned magnitude so the minimum value works as well
+            char digits[24];
+            size_t count = 0;
+            bool negative = false;
+            uint64_t magnitude = (uint64_t)_value;
+            if constexpr (std::is_signed<T>::value)
+            {
+                negative = _value < 0;
+                if (negative)
+                    magnitude = 0 - magnitude;
+            }
+            do
+            {
+                digits[count++] = '0' + magnitude % 10;
+                magnitude /= 10;
+            } while (magnitude > 0);
+
+            if (negative)
+                put('-');
+            while (count > 0)
+                put(digits[--count]);
+            return *this;
+        }
+
+        /**
+         * @brief writes an object member with an integer value
+         */
+        template <typename T>
+        json_writer &field(const char *_key, T _value)
+        {
+            return key(_key).value(_value);
+        }
+
+        /**
+         * @return true if everything fit into the buffer
+         */
+        bool ok() const
+        {
+            return !overflow;
+        }
+
+        /**
+         * @return const char* the text written so far (null terminated)
+         */
+        const char *c_str() const
+        {
+            return buffer;
+        }
+
+        /**
+         * @return const char* the text written so far (same as c_str(),
+         * for code that works with cbor_writer as well)
+         */
+        const char *data() const
+        {
+            return buffer;
+        }
+
+        /**
+         * @return size_t length of the text written so far
+         */
+        size_t size() const
+        {
+            return length;
+        }
+
+        /**
+         * @return size_t number of characters that can still be written
+         */
+        size_t remaining() const
+        {
+            return overflow ? 0 : capacity - length - 1;
+        }
+    };
+};
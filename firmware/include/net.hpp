@@ -13,23 +13,61 @@
 
 #include <el/retcode.hpp>
 
+#include "env.hpp"
+#include "spsc_queue.hpp"
+#include "report_encoding.hpp"
+
 namespace net
 {
+    /**
+     * @brief the information about a single cell
+     * contained in a report
+     */
+    struct cell_report_t
+    {
+        int voltage;
+        int warn_threshold;
+        int alarm_threshold;
+        int sample_count;
+        int soc;        // state of charge in 0.1 %
+        int runtime;    // seconds until alarm voltage is reached (-1 if unknown)
+    };
+
     /**
      * @brief structure containing all the information reported to the server
      * curing the a periodic battery report.
      */
     struct report_t
     {
-        int c1_voltage;
-        int c2_voltage;
-        int c1_warn_threshold;
-        int c2_warn_threshold;
-        int c1_alarm_threshold;
-        int c2_alarm_threshold;
+        cell_report_t cells[env::NR_OF_CELLS];  // lowest cell first
+        int cell_spread;
         int diff_alarm_threshold;
     };
-    extern report_t report;
+
+    /**
+     * @brief a report together with the time it was created.
+     * In JSON reports (REPORT_JSON) a sample is an object with named members:
+     *     {"boot": 3, "timestamp_ms": 60000, "cells": [{"voltage": 3700,
+     *     "warn_threshold": 3000, "alarm_threshold": 2800, "sample_count": 64,
+     *     "soc": 652, "runtime": -1}, ...], "cell_spread": 10,
+     *     "diff_alarm_threshold": 1000}
+     * In CBOR reports (REPORT_CBOR) it is an array with the same values in
+     * the same order, without the member names:
+     *     [boot, timestamp_ms, [[voltage, warn_threshold, alarm_threshold,
+     *     sample_count, soc, runtime], ...], cell_spread, diff_alarm_threshold]
+     * The rest of the report (the "format" member with REPORT_FORMAT_VERSION,
+     * statistics etc.) uses named members in both.
+     * With 2 cells the example above is 292 bytes of JSON and 46 bytes of
+     * CBOR (checked by test_cbor_writer). The values are CBOR integers of
+     * 1 to 9 bytes, so a sample is at most SAMPLE_CBOR_MAX_LEN bytes
+     * (see sample_encoding.hpp, which writes both layouts).
+     */
+    struct sample_t
+    {
+        uint32_t boot;          // boot number the timestamp refers to (see backlog::get_boot_number())
+        int64_t timestamp_ms;   // time since boot
+        report_t report;
+    };
 
     /**
      * @brief starts the networking task(s), trying to
@@ -41,13 +79,36 @@ namespace net
     void init();
 
     /**
-     * @brief tells the network task to send a report
-     * if possible. If the network connection is down or drops while sending, 
-     * the report will not be sent and not be resent after connection is 
-     * up again. This isn't necessary as new reports are generated frequently enough
-     * anyway.
+     * @brief timestamps a new report, adds it to the sample queue and tells
+     * the network task to send the queued samples if possible.
+     * The queue is lock-free, so this never blocks. The network task collects
+     * settings::REPORT_BATCH_SIZE samples (or waits at most
+     * settings::REPORT_BATCH_INTERVAL) and uploads them together, which
+     * saves the per request overhead. Samples that accumulated during a slow
+     * request are uploaded together as well.
+     * If the network connection is down or uploads fail, the network task
+     * moves the queued samples, including the ones of the failed upload, to
+     * the flash backlog (see backlog.hpp) and uploads them from there once the
+     * server is reachable again, a few at a time. Failed uploads are retried
+     * with exponential backoff (up to UPLOAD_RETRY_MAX_MS). If there is no backlog
+     * partition, the samples of a failed upload are lost and only the newest
+     * samples are kept in the queue (see SAMPLE_QUEUE_DEPTH).
      * 
+     * @param _report the report to send
+     */
+    void update(const report_t &_report);
+
+    /**
+     * @brief makes the network task upload the queued samples now instead of
+     * waiting for the batch to complete (see settings::REPORT_BATCH_SIZE),
+     * e.g. because an alarm was raised or released
+     */
+    void flush();
+
+    /**
+     * @return concurrency::queue_stats_t counters of the sample queue
+     * (pushed, popped, dropped, high water mark)
      */
-    void update();
+    concurrency::queue_stats_t get_queue_stats();
 
 };
\ No newline at end of file
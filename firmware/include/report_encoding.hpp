@@ -0,0 +1,41 @@
+/**
+ * @file report_encoding.hpp
+ * @author melektron
+ * @brief encodings of the reports sent to the server
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+namespace net
+{
+    /**
+     * @brief version of the report layout, sent as "format" member at the
+     * start of every report so the server can tell the layouts apart.
+     * Increment it on every incompatible change of the layout.
+     *  1: flat c1_voltage, c2_voltage, ... members, no "format" member
+     *  2: "samples" array of samples with a "cells" array of per-cell
+     *     objects (see net::sample_t)
+     */
+    constexpr int REPORT_FORMAT_VERSION = 2;
+
+    /**
+     * @brief encoding of the reports sent to the server
+     * (selected by the REPORT_ENCODING setting, see net.hpp for the layouts)
+     */
+    enum report_encoding_t
+    {
+        // JSON objects, "Content-Type: application/json"
+        REPORT_JSON = 0,
+        // CBOR (RFC 8949) with the samples as positional arrays,
+        // "Content-Type: application/cbor"
+        REPORT_CBOR = 1,
+
+        // Iterator end value
+        __REPORT_ENCODING_END
+    };
+};
@@ -0,0 +1,144 @@
+/**
+ * @file resolve_cache.hpp
+ * @author melektron
+ * @brief cache for the resolved address of a host name
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace net
+{
+    /**
+     * @brief caches the IPv4 address of one host name for a fixed time to live,
+     * so (m)DNS queries are only needed once in a while instead of for every
+     * request.
+     * The address is refreshed shortly before it expires (see time_until_refresh()),
+     * which the owner can do while it is idle, so requests usually never wait
+     * for a query. If a refresh fails, the old address keeps being used until
+     * it expires and the refresh is retried a few times until then.
+     * The resolver and the current time are passed in, so this doesn't depend
+     * on the network stack and can be tested with a stand-in resolver.
+     * Not thread safe, meant to be owned by one task.
+     */
+    class resolve_cache
+    {
+    public:
+        /**
+         * @brief resolves a host name
+         *
+         * @param _host the host name
+         * @param _address set to the IPv4 address (network byte order) on success
+         * @return true the host was resolved
+         */
+        typedef bool (*resolver_t)(const char *_host, uint32_t &_address);
+
+    private:
+        const char *host;
+        resolver_t resolver;
+        int64_t ttl_us;
+        int64_t refresh_margin_us;
+
+        bool valid = false;
+        uint32_t address = 0;
+        int64_t expiry_time_us = 0;
+        int64_t refresh_time_us = 0;
+
+    public:
+        // statistics
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t failures = 0;
+
+        /**
+         * @param _host host name to resolve (must stay valid)
+         * @param _resolver function used to resolve the host name
+         * @param _ttl_us how long a resolved address is used
+         * @param _refresh_margin_us how long before expiry a refresh is due
+         */
+        resolve_cache(const char *_host, resolver_t _resolver, int64_t _ttl_us, int64_t _refresh_margin_us)
+            : host(_host)
+            , resolver(_resolver)
+            , ttl_us(_ttl_us)
+            , refresh_margin_us(_refresh_margin_us)
+        {}
+
+        /**
+         * @brief returns the cached address, or resolves the host
+         * if there is no valid cached address
+         *
+         * @param _now_us current time
+         * @param _address set to the address (network byte order) on success
+         * @return true an address is available
+         * @return false the host couldn't be resolved
+         */
+        bool lookup(int64_t _now_us, uint32_t &_address)
+        {
+            if (valid && _now_us < expiry_time_us)
+            {
+                hits++;
+                _address = address;
+                return true;
+            }
+
+            misses++;
+            valid = false;
+            if (!refresh(_now_us))
+                return false;
+            _address = address;
+            return true;
+        }
+
+        /**
+         * @brief resolves the host and caches the result. On failure, a
+         * previously cached address stays valid until it expires.
+         *
+         * @param _now_us current time
+         * @return true the host was resolved
+         */
+        bool refresh(int64_t _now_us)
+        {
+            uint32_t new_address;
+            if (!resolver(host, new_address))
+            {
+                failures++;
+                // retry about four times before the address expires
+                refresh_time_us = _now_us + refresh_margin_us / 4;
+                return false;
+            }
+            address = new_address;
+            expiry_time_us = _now_us + ttl_us;
+            refresh_time_us = expiry_time_us - refresh_margin_us;
+            valid = true;
+            return true;
+        }
+
+        /**
+         * @brief forgets the cached address, e.g. because connecting to it
+         * failed or the network changed
+         */
+        void invalidate()
+        {
+            valid = false;
+        }
+
+        /**
+         * @param _now_us current time
+         * @return int64_t time until a refresh is due (0 if it is due now,
+         * -1 if there is no address to refresh)
+         */
+        int64_t time_until_refresh(int64_t _now_us) const
+        {
+            if (!valid || _now_us >= expiry_time_us)
+                return -1;
+            int64_t remaining = refresh_time_us - _now_us;
+            return remaining > 0 ? remaining : 0;
+        }
+    };
+};
@@ -0,0 +1,148 @@
+/**
+ * @file rule_engine.hpp
+ * @author melektron
+ * @brief table driven threshold rule evaluation with hysteresis and debounce
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace alarms
+{
+    // severity of an active rule, higher values take precedence
+    enum severity_t : uint8_t
+    {
+        NONE = 0,
+        WARNING,
+        ALARM,
+    };
+
+    // direction in which a rule's input has to pass the threshold to trigger
+    enum comparison_t : uint8_t
+    {
+        BELOW,  // triggers when input < threshold
+        ABOVE,  // triggers when input > threshold
+    };
+
+    /**
+     * @brief definition of a threshold rule
+     */
+    struct rule_t
+    {
+        // index of the input value the rule checks
+        uint8_t input;
+        comparison_t comparison;
+        severity_t severity;
+        // number of consecutive evaluations the condition has to be met (or
+        // not met) before the rule becomes active (or inactive)
+        uint8_t debounce;
+        int32_t threshold;
+        // distance the input has to move back past the threshold before
+        // an active rule is released
+        int32_t hysteresis;
+    };
+
+    /**
+     * @brief evaluates a flat table of up to MAX_RULES rules in one pass.
+     * The rules are compiled into a normalized form (input * sign > level) so the
+     * evaluation of a rule doesn't depend on its direction and needs no branches
+     * besides the loop.
+     * This doesn't depend on any hardware so it can be fed with recorded traces.
+     *
+     * @tparam MAX_RULES capacity of the rule table
+     */
+    template <size_t MAX_RULES>
+    class rule_engine
+    {
+        // rule in normalized form
+        struct compiled_rule_t
+        {
+            uint8_t input;
+            severity_t severity;
+            uint8_t debounce;
+            int32_t sign;           // +1 for ABOVE, -1 for BELOW
+            int32_t trigger_level;  // normalized threshold
+            int32_t release_level;  // normalized threshold minus hysteresis
+        };
+        compiled_rule_t rules[MAX_RULES];
+        size_t nr_of_rules = 0;
+
+        // dynamic state of each rule
+        bool active[MAX_RULES] = { false };
+        uint8_t counter[MAX_RULES] = { 0 };
+
+    public:
+        /**
+         * @brief replaces the rule table. The dynamic state of rules that keep their
+         * position in the table is preserved, so e.g. changing a threshold
+         * doesn't re-trigger an already active rule.
+         *
+         * @param _rules rule definitions
+         * @param _count number of rules (at most MAX_RULES)
+         */
+        void compile(const rule_t *_rules, size_t _count)
+        {
+            nr_of_rules = _count < MAX_RULES ? _count : MAX_RULES;
+            for (size_t i = 0; i < nr_of_rules; i++)
+            {
+                const rule_t &rule = _rules[i];
+                compiled_rule_t &compiled = rules[i];
+                compiled.input = rule.input;
+                compiled.severity = rule.severity;
+                compiled.debounce = rule.debounce < 1 ? 1 : rule.debounce;
+                compiled.sign = rule.comparison == ABOVE ? 1 : -1;
+                compiled.trigger_level = compiled.sign * rule.threshold;
+                compiled.release_level = compiled.trigger_level - (rule.hysteresis < 0 ? 0 : rule.hysteresis);
+            }
+            for (size_t i = nr_of_rules; i < MAX_RULES; i++)
+            {
+                active[i] = false;
+                counter[i] = 0;
+            }
+        }
+
+        /**
+         * @brief evaluates all rules with a new set of input values
+         *
+         * @param _inputs input values, indexed by rule_t::input
+         * @return severity_t highest severity of all active rules
+         */
+        severity_t evaluate(const int32_t *_inputs)
+        {
+            uint8_t severity = NONE;
+            for (size_t i = 0; i < nr_of_rules; i++)
+            {
+                const compiled_rule_t &rule = rules[i];
+                int32_t value = rule.sign * _inputs[rule.input];
+                // an active rule holds until the value leaves the hysteresis band
+                int32_t level = active[i] ? rule.release_level : rule.trigger_level;
+                bool condition = value > level;
+
+                // debounce: count consecutive evaluations that disagree with the state
+                uint8_t count = condition != active[i] ? counter[i] + 1 : 0;
+                bool flip = count >= rule.debounce;
+                active[i] = active[i] != flip;
+                counter[i] = flip ? 0 : count;
+
+                uint8_t rule_severity = active[i] ? rule.severity : NONE;
+                severity = rule_severity > severity ? rule_severity : severity;
+            }
+            return (severity_t)severity;
+        }
+
+        /**
+         * @return true if the rule at the given position is currently active
+         */
+        bool is_active(size_t _rule) const
+        {
+            return _rule < nr_of_rules && active[_rule];
+        }
+    };
+} // namespace alarms
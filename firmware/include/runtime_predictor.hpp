@@ -0,0 +1,119 @@
+/**
+ * @file runtime_predictor.hpp
+ * @author melektron
+ * @brief remaining runtime estimation using a sliding window linear regression
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace battery
+{
+    /**
+     * @brief fits a line through the last N voltage samples (taken at a fixed
+     * period) and extrapolates when it will cross a threshold.
+     * The regression sums are updated incrementally when a sample enters and
+     * one leaves the window, so adding a sample is O(1) and the prediction
+     * uses integer math only.
+     * This doesn't depend on any hardware so it can be fed with recorded
+     * or synthetic discharge curves as well.
+     *
+     * @tparam N window size in samples
+     */
+    template <size_t N>
+    class runtime_predictor
+    {
+        static_assert(N >= 2, "the regression window needs at least two samples");
+
+        // window ring buffer, needed to remove the oldest sample from the sums
+        uint16_t window[N] = { 0 };
+        size_t head = 0;    // index of the oldest sample (= next to be overwritten)
+        size_t count = 0;   // number of valid samples in the window
+
+        // sum of y and sum of x * y with x = 0 for the oldest sample in the window
+        int64_t sum_y = 0;
+        int64_t sum_xy = 0;
+
+    public:
+        /**
+         * @brief minimum number of samples before a prediction is made
+         */
+        static constexpr size_t MIN_SAMPLES = N / 4 < 2 ? 2 : N / 4;
+
+        /**
+         * @brief adds a sample to the window, dropping the oldest
+         * one if the window is full
+         *
+         * @param _voltage voltage in mV
+         */
+        void add(int _voltage)
+        {
+            if (count < N)
+            {
+                sum_xy += (int64_t)count * _voltage;
+                sum_y += _voltage;
+                window[(head + count) % N] = _voltage;
+                count++;
+                return;
+            }
+
+            // shifting the window re-indexes every sample to x - 1, which
+            // subtracts the new sum of y from the sum of x * y
+            int oldest = window[head];
+            window[head] = _voltage;
+            head = (head + 1) % N;
+            sum_y += _voltage - oldest;
+            sum_xy += (int64_t)N * _voltage - sum_y;
+        }
+
+        /**
+         * @brief discards all samples
+         */
+        void reset()
+        {
+            head = 0;
+            count = 0;
+            sum_y = 0;
+            sum_xy = 0;
+        }
+
+        /**
+         * @brief extrapolates the fitted line to the threshold voltage
+         *
+         * @param _threshold voltage in mV
+         * @return int32_t number of sample periods until the threshold is reached,
+         * 0 if it is already reached or -1 if unknown (not enough samples
+         * or voltage not falling)
+         */
+        int32_t samples_until(int _threshold) const
+        {
+            if (count < MIN_SAMPLES)
+                return -1;
+
+            const int64_t m = count;
+            const int64_t sum_x = m * (m - 1) / 2;
+            // slope = slope_num / slope_den (mV per sample)
+            const int64_t slope_num = m * sum_xy - sum_x * sum_y;
+            const int64_t slope_den = m * m * (m * m - 1) / 12;
+
+            // value of the fitted line at the newest sample, scaled by 2 * m * slope_den
+            const int64_t fit_now_scaled = 2 * slope_den * sum_y + slope_num * m * (m - 1);
+            const int64_t margin_scaled = fit_now_scaled - (int64_t)_threshold * 2 * m * slope_den;
+
+            if (margin_scaled <= 0)
+                return 0;
+            if (slope_num >= 0)
+                return -1;
+
+            int64_t samples = margin_scaled / (-slope_num * 2 * m);
+            return samples > INT32_MAX ? INT32_MAX : (int32_t)samples;
+        }
+    };
+} // namespace battery
@@ -0,0 +1,82 @@
+/**
+ * @file sag.hpp
+ * @author melektron
+ * @brief high rate capture of cell voltage sags
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "env.hpp"
+
+namespace sag
+{
+    // number of cell samples averaged into one capture sample, chosen
+    // so captures are sampled at about 1 kHz
+    constexpr int DECIMATION_FACTOR = (1000 + env::CELL_SAMPLE_PERIOD_US / 2) / env::CELL_SAMPLE_PERIOD_US;
+    static_assert(DECIMATION_FACTOR >= 1, "cell sample rate is too low for sag captures");
+    // actual time between two samples of a capture (reported with the captures).
+    // This is only exactly 1 ms if the cell sample period divides 1 ms (e.g. 1050 us for 3 cells).
+    constexpr int CAPTURE_SAMPLE_PERIOD_US = DECIMATION_FACTOR * env::CELL_SAMPLE_PERIOD_US;
+    // number of samples recorded before and after (including) the trigger
+    constexpr size_t PRE_TRIGGER_SAMPLES = 100;
+    constexpr size_t POST_TRIGGER_SAMPLES = 200;
+    constexpr size_t CAPTURE_SAMPLES = PRE_TRIGGER_SAMPLES + POST_TRIGGER_SAMPLES;
+
+    /**
+     * @brief a recorded voltage curve around a sag event
+     */
+    struct capture_t
+    {
+        // index of the cell the sag was detected on (0 = lowest cell)
+        int cell;
+        // time of the trigger sample in us since boot (the time of the
+        // last conversion averaged into it)
+        int64_t trigger_time_us;
+        // lowest voltage in the capture in mV
+        int min_voltage;
+        // voltage curve in mV, the trigger sample is at index PRE_TRIGGER_SAMPLES
+        uint16_t samples[CAPTURE_SAMPLES];
+    };
+
+    /**
+     * @brief creates the capture queue. Must be called
+     * before the sampling task starts feeding samples.
+     */
+    void init();
+
+    /**
+     * @brief feeds a cell voltage sample into the capture ring buffer of a cell.
+     * This is called by the sampling task for every sample of a cell.
+     * When the (decimated) voltage drops below settings::SAG_TRIGGER_VOLTAGE,
+     * a window around the event is recorded and queued. The trigger is re-armed
+     * once the voltage has recovered above the threshold.
+     * 
+     * @param _cell index of the cell the sample belongs to
+     * @param _voltage cell voltage in mV
+     * @param _time_us time the sample was converted in us since boot
+     */
+    void feed(int _cell, int _voltage, int64_t _time_us);
+
+    /**
+     * @brief takes the oldest completed capture out of the queue (non-blocking)
+     * 
+     * @param _capture capture to write to
+     * @return true - a capture was written to _capture
+     * @return false - there are no captures queued
+     */
+    bool take_capture(capture_t &_capture);
+
+    /**
+     * @return uint32_t number of captures that were dropped 
+     * because the queue was full
+     */
+    uint32_t get_dropped_count();
+} // namespace sag
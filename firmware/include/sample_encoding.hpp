@@ -0,0 +1,81 @@
+/**
+ * @file sample_encoding.hpp
+ * @author melektron
+ * @brief encoding of the samples in the reports sent to the server
+ * (layouts documented at net::sample_t)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include "net.hpp"
+#include "json_writer.hpp"
+#include "cbor_writer.hpp"
+
+// upper bound of the JSON text of one sample (~150 characters per cell
+// and ~100 for the rest with all values at their maximum length)
+#define SAMPLE_JSON_MAX_LEN (128 + env::NR_OF_CELLS * 192)
+// upper bound of the CBOR encoding of one sample (32 bytes per cell
+// and 28 for the rest with all values at their maximum length)
+#define SAMPLE_CBOR_MAX_LEN (32 + env::NR_OF_CELLS * 32)
+
+namespace net
+{
+    /**
+     * @brief writes a sample as JSON object with named members
+     */
+    inline void write_sample(json_writer &_writer, const sample_t &_sample)
+    {
+        const report_t &report = _sample.report;
+        _writer.begin_object();
+        _writer.field("boot", _sample.boot);
+        _writer.field("timestamp_ms", _sample.timestamp_ms);
+        _writer.key("cells").begin_array();
+        for (const cell_report_t &cell : report.cells)
+        {
+            _writer.begin_object()
+                .field("voltage", cell.voltage)
+                .field("warn_threshold", cell.warn_threshold)
+                .field("alarm_threshold", cell.alarm_threshold)
+                .field("sample_count", cell.sample_count)
+                .field("soc", cell.soc)
+                .field("runtime", cell.runtime)
+                .end_object();
+        }
+        _writer.end_array();
+        _writer.field("cell_spread", report.cell_spread);
+        _writer.field("diff_alarm_threshold", report.diff_alarm_threshold);
+        _writer.end_object();
+    }
+
+    /**
+     * @brief writes a sample as CBOR array with positional members
+     */
+    inline void write_sample(cbor_writer &_writer, const sample_t &_sample)
+    {
+        const report_t &report = _sample.report;
+        _writer.begin_array();
+        _writer.value(_sample.boot);
+        _writer.value(_sample.timestamp_ms);
+        _writer.begin_array();
+        for (const cell_report_t &cell : report.cells)
+        {
+            _writer.begin_array()
+                .value(cell.voltage)
+                .value(cell.warn_threshold)
+                .value(cell.alarm_threshold)
+                .value(cell.sample_count)
+                .value(cell.soc)
+                .value(cell.runtime)
+                .end_array();
+        }
+        _writer.end_array();
+        _writer.value(report.cell_spread);
+        _writer.value(report.diff_alarm_threshold);
+        _writer.end_array();
+    }
+};
@@ -0,0 +1,73 @@
+/**
+ * @file scheduler.hpp
+ * @author melektron
+ * @brief policy for adapting the monitoring interval to the battery state
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+namespace scheduler
+{
+    /**
+     * @brief parameters of the interval policy
+     */
+    struct policy_t
+    {
+        // interval used at or below the warning threshold (ms)
+        int min_interval_ms;
+        // interval used when the pack is far above the warning threshold (ms)
+        int max_interval_ms;
+        // headroom above the warning threshold from which on the
+        // maximum interval is used (mV)
+        int slow_margin_mv;
+    };
+
+    /**
+     * @brief calculates the time until the next monitoring cycle. The closer
+     * the pack is to its thresholds, the shorter the interval gets, scaling
+     * linearly from max_interval_ms at slow_margin_mv of headroom down to
+     * min_interval_ms at the threshold.
+     * This is a pure function so it can be tested without hardware.
+     *
+     * @param _headroom_mv smallest distance of any monitored value to its 
+     * warning threshold (negative if a threshold is exceeded)
+     * @param _policy interval policy parameters
+     * @return int interval in ms
+     */
+    constexpr int next_interval(int _headroom_mv, const policy_t &_policy)
+    {
+        if (_policy.max_interval_ms <= _policy.min_interval_ms)
+            return _policy.min_interval_ms;
+        if (_headroom_mv <= 0)
+            return _policy.min_interval_ms;
+        if (_headroom_mv >= _policy.slow_margin_mv)
+            return _policy.max_interval_ms;
+
+        int range = _policy.max_interval_ms - _policy.min_interval_ms;
+        return _policy.min_interval_ms + (int)((long long)range * _headroom_mv / _policy.slow_margin_mv);
+    }
+
+    /**
+     * @brief calculates how long a cycle that was requested early (by a
+     * threshold crossing or a settings change) has to be held back, so cycles
+     * never run closer together than min_interval_ms. The first request after
+     * a quiet period is served right away, a value flapping around a
+     * threshold can't start a cycle (and an upload) for every DMA frame.
+     * This is a pure function so it can be tested without hardware.
+     *
+     * @param _since_last_cycle_ms time since the start of the last cycle
+     * @param _policy interval policy parameters
+     * @return int time to wait before starting the next cycle in ms (0 = now)
+     */
+    constexpr int wake_delay(int _since_last_cycle_ms, const policy_t &_policy)
+    {
+        if (_since_last_cycle_ms >= _policy.min_interval_ms)
+            return 0;
+        return _policy.min_interval_ms - (_since_last_cycle_ms < 0 ? 0 : _since_last_cycle_ms);
+    }
+} // namespace scheduler
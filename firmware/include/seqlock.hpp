@@ -0,0 +1,141 @@
+/**
+ * @file seqlock.hpp
+ * @author melektron
+ * @brief sequence lock for publishing snapshots of a structure between tasks
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+namespace concurrency
+{
+    /**
+     * @brief holds a value of type T that one writer can publish as a whole
+     * and any number of readers can copy without ever seeing a partially
+     * written (torn) value. The writer never blocks, readers retry
+     * if the value changed while they were copying it.
+     * The value is stored as relaxed atomic words, so the concurrent
+     * accesses are well defined.
+     * Only one task may call store().
+     *
+     * @tparam T trivially copyable value type
+     */
+    template <typename T>
+    class seqlock
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "seqlock values must be trivially copyable");
+
+        static constexpr size_t NR_OF_WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+        // even while the value is stable, odd while a write is in progress
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<uint32_t> words[NR_OF_WORDS] = {};
+
+    public:
+        /**
+         * @brief publishes a new value (single writer only)
+         *
+         * @param _value the value to publish
+         */
+        void store(const T &_value)
+        {
+            uint32_t buffer[NR_OF_WORDS] = { 0 };
+            memcpy(buffer, &_value, sizeof(T));
+
+            uint32_t seq = sequence.load(std::memory_order_relaxed);
+            sequence.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            for (size_t i = 0; i < NR_OF_WORDS; i++)
+                words[i].store(buffer[i], std::memory_order_relaxed);
+
+            sequence.store(seq + 2, std::memory_order_release);
+        }
+
+        /**
+         * @brief copies a consistent snapshot of the latest published value
+         *
+         * @return T the value
+         */
+        T load() const
+        {
+            uint32_t buffer[NR_OF_WORDS];
+            uint32_t seq_before;
+            uint32_t seq_after;
+            do
+            {
+                seq_before = sequence.load(std::memory_order_acquire);
+                for (size_t i = 0; i < NR_OF_WORDS; i++)
+                    buffer[i] = words[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                seq_after = sequence.load(std::memory_order_relaxed);
+            } while ((seq_before & 1) || seq_before != seq_after);
+
+            T value;
+            memcpy(&value, buffer, sizeof(T));
+            return value;
+        }
+
+        /**
+         * @brief copies one member of the latest published value without
+         * copying all of it. A member within one word is read with a single
+         * atomic load (words are always stored whole), larger members are
+         * read with the same retry as load().
+         * Separate calls may return members of different values, use load()
+         * for members that belong together.
+         *
+         * @tparam F type of the member
+         * @param _offset offset of the member in T (offsetof())
+         * @return F the member's value
+         */
+        template <typename F>
+        F load_field(size_t _offset) const
+        {
+            static_assert(std::is_trivially_copyable<F>::value, "seqlock values must be trivially copyable");
+
+            const size_t first = _offset / sizeof(uint32_t);
+            const size_t count = (_offset + sizeof(F) - 1) / sizeof(uint32_t) - first + 1;
+            uint32_t buffer[(sizeof(F) + sizeof(uint32_t) - 1) / sizeof(uint32_t) + 1];
+
+            if (count == 1)
+            {
+                buffer[0] = words[first].load(std::memory_order_acquire);
+            }
+            else
+            {
+                uint32_t seq_before;
+                uint32_t seq_after;
+                do
+                {
+                    seq_before = sequence.load(std::memory_order_acquire);
+                    for (size_t i = 0; i < count; i++)
+                        buffer[i] = words[first + i].load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    seq_after = sequence.load(std::memory_order_relaxed);
+                } while ((seq_before & 1) || seq_before != seq_after);
+            }
+
+            F value;
+            memcpy(&value, (const uint8_t *)buffer + _offset % sizeof(uint32_t), sizeof(F));
+            return value;
+        }
+
+        /**
+         * @return uint32_t number of values published so far
+         */
+        uint32_t get_version() const
+        {
+            return sequence.load(std::memory_order_acquire) / 2;
+        }
+    };
+} // namespace concurrency
@@ -0,0 +1,104 @@
+/**
+ * @file sequential_estimator.hpp
+ * @author melektron
+ * @brief adaptive averaging stage used by the ADC sampling engine
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace battery
+{
+    /**
+     * @brief averages the samples of a single channel, stopping as soon as
+     * the mean is known precisely enough. It keeps a running mean and variance
+     * (Welford's algorithm) and completes an estimate once the ~95% confidence
+     * interval of the mean is narrower than the configured bound, but never
+     * before min_samples and never after max_samples.
+     * This doesn't depend on any hardware so it can be fed with recorded
+     * sample streams as well.
+     */
+    class sequential_estimator
+    {
+        uint32_t min_samples = 2;
+        uint32_t max_samples = 2;
+        // squared confidence bound divided by z^2 (z = 2), so the stopping
+        // condition z^2 * var / n < bound^2 doesn't need a square root
+        float bound_sq_over_z_sq = 0;
+
+        uint32_t count = 0;
+        float mean = 0;
+        float m2 = 0;
+
+        int last_result = 0;
+        uint32_t last_count = 0;
+
+    public:
+        /**
+         * @brief sets the stopping parameters. They take effect 
+         * from the next sample on.
+         *
+         * @param _min_samples minimum number of samples per estimate (at least 2)
+         * @param _max_samples maximum number of samples per estimate
+         * @param _bound half width of the confidence interval at which to stop (same unit as samples)
+         */
+        void configure(uint32_t _min_samples, uint32_t _max_samples, int _bound)
+        {
+            min_samples = _min_samples < 2 ? 2 : _min_samples;
+            max_samples = _max_samples < min_samples ? min_samples : _max_samples;
+            bound_sq_over_z_sq = (float)_bound * (float)_bound / 4.0f;
+        }
+
+        /**
+         * @brief adds a sample to the current estimate
+         *
+         * @param _sample sample value
+         * @retval true - this sample completed an estimate and result() has been updated
+         * @retval false - estimate is not yet complete
+         */
+        bool add(int _sample)
+        {
+            count++;
+            float delta = _sample - mean;
+            mean += delta / count;
+            m2 += delta * (_sample - mean);
+
+            if (count < min_samples)
+                return false;
+
+            // variance of the mean = m2 / (n - 1) / n
+            bool converged = m2 < bound_sq_over_z_sq * (float)(count - 1) * (float)count;
+            if (!converged && count < max_samples)
+                return false;
+
+            last_result = (int)(mean < 0 ? mean - 0.5f : mean + 0.5f);
+            last_count = count;
+            count = 0;
+            mean = 0;
+            m2 = 0;
+            return true;
+        }
+
+        /**
+         * @return int mean of the last completed estimate (rounded)
+         */
+        int result() const
+        {
+            return last_result;
+        }
+
+        /**
+         * @return uint32_t number of samples the last completed estimate needed
+         */
+        uint32_t result_count() const
+        {
+            return last_count;
+        }
+    };
+} // namespace battery
@@ -12,27 +12,130 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <bitset>
+#include <initializer_list>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string>
+
+#include "env.hpp"
 
 namespace settings
 {
+    // all settings. Names, defaults, ranges and units are defined in the
+    // schema table in settings.cpp, which has to list the keys in this order
+    // (checked at compile time).
     enum key_t
     {
+        // per cell settings: each of these occupies env::NR_OF_CELLS consecutive
+        // keys (lowest cell first), use cell_key() to select the key of a cell
+
         // voltage at which (and below) low battery warning should be played
-        CELL1_WARN_VOLTAGE = 0,
-        CELL2_WARN_VOLTAGE,
+        CELL_WARN_VOLTAGE = 0,
         // voltage at which (and below) battery alarm should be played
-        CELL1_ALARM_VOLTAGE,
-        CELL2_ALARM_VOLTAGE,
-        // voltage difference between cells at which (and above) the alarm
-        // for too high voltage difference should be played
-        CELL_ALARM_VOLTAGE_DIFFERENCE,
+        CELL_ALARM_VOLTAGE = CELL_WARN_VOLTAGE + env::NR_OF_CELLS,
+        // correction factor applied to the measured cell voltage in 1/10000
+        // (10000 = 1.0), used to compensate voltage divider tolerances
+        CELL_VOLTAGE_CORRECTION = CELL_ALARM_VOLTAGE + env::NR_OF_CELLS,
+
+        // global settings
+
+        // voltage difference between the highest and lowest cell at which (and above) 
+        // the alarm for too high voltage difference should be played
+        CELL_ALARM_VOLTAGE_DIFFERENCE = CELL_VOLTAGE_CORRECTION + env::NR_OF_CELLS,
+        // half width of the confidence interval (mV) at which the averaging
+        // of cell voltage samples stops early
+        SAMPLING_CONFIDENCE_BOUND,
+        // minimum and maximum number of samples averaged per measurement
+        SAMPLING_MIN_SAMPLES,
+        SAMPLING_MAX_SAMPLES,
+        // voltage below which a cell voltage sag is captured at high rate
+        SAG_TRIGGER_VOLTAGE,
+        // time constant (ms) of the low pass filter applied to the cell voltages
+        // and the cell difference (0 disables filtering)
+        FILTER_TIME_CONSTANT,
+        // chemistry of the cells, used for the state of charge
+        // estimation (battery::soc::chemistry_t)
+        BATTERY_CHEMISTRY,
+        // shortest and longest interval (ms) of the monitoring cycle 
+        // (see scheduler::policy_t)
+        MONITOR_MIN_INTERVAL,
+        MONITOR_MAX_INTERVAL,
+        // headroom (mV) above the warning thresholds from which on
+        // the longest monitoring interval is used
+        MONITOR_SLOW_MARGIN,
+        // distance (mV) a value has to recover past a threshold before
+        // the warning or alarm is released
+        ALARM_HYSTERESIS,
+        // number of consecutive monitoring cycles a threshold has to be exceeded
+        // (or recovered) before a warning or alarm is raised (or released)
+        ALARM_DEBOUNCE,
+        // encoding of the reports sent to the server (net::report_encoding_t)
+        REPORT_ENCODING,
+        // number of samples collected before they are uploaded together
+        // (1 uploads every sample immediately)
+        REPORT_BATCH_SIZE,
+        // longest time (ms) a sample waits for its batch to complete
+        REPORT_BATCH_INTERVAL,
 
         // Iterator end value
         __SETTING_END
     };
 
+    // number of per cell settings at the start of key_t
+    constexpr size_t NR_OF_PER_CELL_SETTINGS = 3;
+
+    /**
+     * @brief selects the key of a per cell setting for a specific cell
+     * 
+     * @param _setting the per cell setting (e.g. CELL_WARN_VOLTAGE)
+     * @param _cell index of the cell (0 = lowest cell)
+     * @return key_t the key of the setting for that cell
+     */
+    constexpr key_t cell_key(key_t _setting, size_t _cell)
+    {
+        return (key_t)(_setting + _cell);
+    }
+
+    /**
+     * @brief consistent copy of all setting values
+     */
+    struct snapshot_t
+    {
+        int32_t values[__SETTING_END];
+
+        int32_t operator[](key_t _key) const
+        {
+            return values[_key];
+        }
+    };
+
+    // set of settings, indexed by key_t
+    using key_mask_t = std::bitset<__SETTING_END>;
+
+    /**
+     * @brief called when subscribed settings change
+     *
+     * @param _changed which of the subscribed settings changed
+     */
+    typedef void (*change_callback_t)(const key_mask_t &_changed);
+
+    /**
+     * @param _keys the settings to include
+     * @return key_mask_t mask with the given settings
+     */
+    key_mask_t make_mask(std::initializer_list<key_t> _keys);
+
+    /**
+     * @param _setting a per cell setting (e.g. CELL_WARN_VOLTAGE)
+     * @return key_mask_t mask with that setting of all cells
+     */
+    key_mask_t make_cell_mask(key_t _setting);
+
     /**
      * @brief initializes NVS to load and store settings
+     * and starts the task calling the change callbacks
      */
     void init();
 
@@ -45,12 +148,130 @@ namespace settings
      */
     int32_t get(key_t _key);
 
+    /**
+     * @brief reads all settings at once. Use this instead of multiple 
+     * get() calls when values that belong together (e.g. the warning and
+     * alarm threshold) must not come from different transactions.
+     * 
+     * @return snapshot_t values of all settings
+     */
+    snapshot_t get_all();
+
+    /**
+     * @brief gives the task a notification (xTaskNotifyGive) whenever
+     * any of the settings in _keys changes. The task can wait for it with
+     * ulTaskNotifyTake.
+     * Subscriptions cannot be removed, there is space for a fixed number
+     * of subscribers (see MAX_SUBSCRIBERS).
+     *
+     * @param _keys the settings to watch
+     * @param _task the task to notify
+     */
+    void subscribe(const key_mask_t &_keys, TaskHandle_t _task);
+
+    /**
+     * @brief calls _callback whenever any of the settings in _keys changes.
+     * Callbacks run one after the other on the settings task (not on the
+     * task that changed the setting), so they may take a while and call
+     * get() but must not block forever. Changes committed while callbacks
+     * are running are combined into one call.
+     *
+     * @param _keys the settings to watch
+     * @param _callback function to call with the changed keys
+     */
+    void subscribe(const key_mask_t &_keys, change_callback_t _callback);
+
+    /**
+     * @param _key the setting
+     * @return const char* NVS name of the setting (e.g. "c1_warn_v")
+     */
+    const char *get_name(key_t _key);
+
+    /**
+     * @brief looks up a setting by its NVS name
+     *
+     * @param _name the name to look for
+     * @param _key set to the key of the setting if found
+     * @return true the setting exists
+     * @return false there is no setting with that name
+     */
+    bool find_key(const char *_name, key_t &_key);
+
+    /**
+     * @brief checks whether a value is in the valid range of a setting
+     *
+     * @param _key the setting
+     * @param _value the value to check
+     * @return true the value may be stored in the setting
+     * @return false the key doesn't exist or the value is out of range
+     */
+    bool validate(key_t _key, int32_t _value);
+
+    /**
+     * @brief generates a JSON schema (draft 2020-12) describing all
+     * settings by their NVS name with type, default, range and unit
+     *
+     * @return std::string the schema as JSON text
+     */
+    std::string get_json_schema();
+
     /**
      * @brief updates a setting with a new value and stores
-     * that value in NVS
+     * that value in NVS. To update multiple settings, use a transaction.
      *
      * @param _key the setting to write (use enum constants)
      * @param _value the new value to be stored
+     * @return true the value was valid (and stored if it changed)
+     * @return false the value was rejected (see validate()) or is
+     * inconsistent with another setting (e.g. alarm above warn voltage)
      */
-    void set(key_t _key, int32_t _value);
+    bool set(key_t _key, int32_t _value);
+
+    /**
+     * @brief collects updates of multiple settings in RAM and applies
+     * them all at once with a single NVS commit. Readers see either none
+     * or all of the updates. Settings that keep their value are not
+     * written to flash at all.
+     * 
+     * Example:
+     *     settings::transaction t;
+     *     t.set(settings::cell_key(settings::CELL_WARN_VOLTAGE, 0), 3100);
+     *     t.set(settings::cell_key(settings::CELL_ALARM_VOLTAGE, 0), 2900);
+     *     t.commit();
+     */
+    class transaction
+    {
+        // new values of the staged settings
+        int32_t staged_values[__SETTING_END];
+        // which settings are staged
+        std::bitset<__SETTING_END> staged;
+
+    public:
+        transaction() = default;
+
+        /**
+         * @brief stages a new value for a setting. Setting the same key
+         * multiple times keeps the last value.
+         *
+         * @param _key the setting to write (use enum constants)
+         * @param _value the new value to be stored
+         * @return true the value was staged
+         * @return false the value was rejected (see validate())
+         */
+        bool set(key_t _key, int32_t _value);
+
+        /**
+         * @brief writes all staged settings that changed to NVS, commits
+         * once and then publishes them to readers. Nothing is written if
+         * the resulting settings are inconsistent (a minimum above its
+         * maximum or an alarm voltage above its warn voltage). The
+         * transaction is empty again afterwards.
+         * 
+         * @param _changes set to the number of settings that actually
+         * changed (optional)
+         * @return true the settings were applied
+         * @return false the settings are inconsistent and were rejected
+         */
+        bool commit(size_t *_changes = nullptr);
+    };
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+/**
+ * @file soc.hpp
+ * @author melektron
+ * @brief state of charge estimation from the cell open circuit voltage
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+namespace battery::soc
+{
+    // supported cell chemistries (values as stored in settings::BATTERY_CHEMISTRY)
+    enum chemistry_t
+    {
+        LIPO = 0,
+        LI_ION,
+        LIFEPO4,
+
+        // Iterator end value
+        __CHEMISTRY_END
+    };
+
+    /**
+     * @brief maps a cell voltage to the state of charge using the
+     * open circuit voltage curve of a cell chemistry. Voltages outside
+     * of the curve are clamped to 0 % or 100 %.
+     *
+     * @param _voltage cell voltage in mV
+     * @param _chemistry the chemistry curve to use
+     * @return int state of charge in 0.1 % (0 to 1000)
+     */
+    int from_voltage(int _voltage, chemistry_t _chemistry);
+
+    /**
+     * @brief same as above, using the chemistry configured
+     * in settings::BATTERY_CHEMISTRY
+     *
+     * @param _voltage cell voltage in mV
+     * @return int state of charge in 0.1 % (0 to 1000)
+     */
+    int from_voltage(int _voltage);
+} // namespace battery::soc
@@ -0,0 +1,165 @@
+/**
+ * @file spsc_queue.hpp
+ * @author melektron
+ * @brief wait-free single producer single consumer ring buffer
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "seqlock.hpp"
+
+namespace concurrency
+{
+    // what happens when a value is pushed into a full queue
+    enum class overflow_policy_t
+    {
+        DROP_NEWEST,    // the new value is rejected
+        DROP_OLDEST,    // the oldest value is overwritten
+    };
+
+    /**
+     * @brief counters describing the activity of a queue
+     */
+    struct queue_stats_t
+    {
+        uint32_t pushed;        // values pushed by the producer
+        uint32_t popped;        // values taken by the consumer
+        uint32_t dropped;       // values lost due to overflow
+        uint32_t high_water;    // maximum number of values that were queued at once
+    };
+
+    /**
+     * @brief ring buffer passing values from exactly one producer task to
+     * exactly one consumer task without locks. push() is wait-free.
+     * Each slot is a seqlock tagged with the position it was written for,
+     * so with DROP_OLDEST the producer can overwrite slots the consumer
+     * is reading at the same time: the consumer detects this
+     * and skips ahead to the oldest value still available.
+     *
+     * @tparam T trivially copyable value type
+     * @tparam N capacity of the queue
+     */
+    template <typename T, size_t N>
+    class spsc_queue
+    {
+        static_assert(N >= 1, "a queue needs at least one slot");
+
+        struct entry_t
+        {
+            uint32_t position;
+            T value;
+        };
+        seqlock<entry_t> slots[N];
+
+        // position the producer writes next (only written by the producer)
+        std::atomic<uint32_t> head{0};
+        // position the consumer reads next (only written by the consumer)
+        std::atomic<uint32_t> tail{0};
+
+        const overflow_policy_t policy;
+
+        std::atomic<uint32_t> pushed{0};
+        std::atomic<uint32_t> popped{0};
+        std::atomic<uint32_t> dropped{0};
+        std::atomic<uint32_t> high_water{0};
+
+    public:
+        explicit spsc_queue(overflow_policy_t _policy)
+            : policy(_policy)
+        {}
+
+        /**
+         * @brief adds a value to the queue (producer only)
+         *
+         * @param _value value to add
+         * @retval true - the value was queued
+         * @retval false - the queue is full and the policy is DROP_NEWEST
+         */
+        bool push(const T &_value)
+        {
+            uint32_t position = head.load(std::memory_order_relaxed);
+            uint32_t fill = position - tail.load(std::memory_order_acquire);
+
+            if (fill >= N && policy == overflow_policy_t::DROP_NEWEST)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            slots[position % N].store({position, _value});
+            head.store(position + 1, std::memory_order_release);
+
+            pushed.fetch_add(1, std::memory_order_relaxed);
+            fill = fill < N ? fill + 1 : N;
+            if (fill > high_water.load(std::memory_order_relaxed))
+                high_water.store(fill, std::memory_order_relaxed);
+            return true;
+        }
+
+        /**
+         * @brief takes the oldest value out of the queue (consumer only)
+         *
+         * @param _value is set to the value taken
+         * @retval true - a value was taken
+         * @retval false - the queue is empty
+         */
+        bool pop(T &_value)
+        {
+            uint32_t position = tail.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                uint32_t newest = head.load(std::memory_order_acquire);
+                if (position == newest)
+                    return false;
+
+                // skip values that have already been overwritten
+                if (newest - position > N)
+                {
+                    dropped.fetch_add(newest - N - position, std::memory_order_relaxed);
+                    position = newest - N;
+                }
+
+                entry_t entry = slots[position % N].load();
+                // the slot was overwritten while reading, try again with the new head
+                if (entry.position != position)
+                    continue;
+
+                tail.store(position + 1, std::memory_order_release);
+                popped.fetch_add(1, std::memory_order_relaxed);
+                _value = entry.value;
+                return true;
+            }
+        }
+
+        /**
+         * @return size_t number of values currently in the queue
+         */
+        size_t size() const
+        {
+            uint32_t fill = head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+            return fill < N ? fill : N;
+        }
+
+        /**
+         * @return queue_stats_t the current queue counters
+         */
+        queue_stats_t get_stats() const
+        {
+            return {
+                .pushed = pushed.load(std::memory_order_relaxed),
+                .popped = popped.load(std::memory_order_relaxed),
+                .dropped = dropped.load(std::memory_order_relaxed),
+                .high_water = high_water.load(std::memory_order_relaxed),
+            };
+        }
+    };
+} // namespace concurrency
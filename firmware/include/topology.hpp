@@ -0,0 +1,113 @@
+/**
+ * @file topology.hpp
+ * @author melektron
+ * @brief core and priority placement of all application tasks
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+
+namespace topology
+{
+    // CPU cores of the ESP32
+    enum core_t : BaseType_t
+    {
+        // also runs the Wi-Fi driver, the lwIP tcpip task, esp_timer and the
+        // default event loop (CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_0 and
+        // CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0 in sdkconfig, checked in topology.cpp)
+        PRO_CORE = 0,
+        APP_CORE = 1,
+    };
+
+    // all application tasks
+    enum task_t
+    {
+        SAMPLING,       // ADC demultiplexing and signal processing
+        MONITORING,     // threshold and alarm evaluation
+        NETWORKING,     // report uploads
+        LED,            // status LED
+        BUZZER,         // alarm sounds
+        SETTINGS,       // settings change callbacks
+        __TASK_END
+    };
+
+    /**
+     * @brief where and how urgently a task runs
+     */
+    struct placement_t
+    {
+        task_t task;
+        const char *name;
+        core_t core;
+        UBaseType_t priority;
+    };
+
+    /**
+     * @brief placement of every task.
+     * The measurement path (sampling and alarm evaluation) owns the APP core,
+     * so a stuck HTTP request or a busy Wi-Fi driver on the PRO core can never
+     * delay an alarm. The indication tasks share the APP core at a low priority,
+     * they only run for a few µs when switching modes or tones and then sleep.
+     * Networking stays below the Wi-Fi driver task (priority 23) and the lwIP
+     * tcpip task (priority 18) on the PRO core, the settings task rebuilding
+     * derived state after changes runs below it. Both system tasks run at a
+     * higher priority than sampling, so they must never float to the APP core.
+     */
+    constexpr placement_t PLACEMENTS[] = {
+        {SAMPLING,   "sampling",   APP_CORE, 10},
+        {MONITORING, "monitoring", APP_CORE, 9},
+        {NETWORKING, "networking", PRO_CORE, 5},
+        {LED,        "led",        APP_CORE, 2},
+        {BUZZER,     "buzzer",     APP_CORE, 2},
+        {SETTINGS,   "settings",   PRO_CORE, 3},
+    };
+
+    /**
+     * @return true if every task has exactly one entry at the position
+     * of its id and all priorities are valid
+     */
+    constexpr bool placements_valid()
+    {
+        if (sizeof(PLACEMENTS) / sizeof(PLACEMENTS[0]) != __TASK_END)
+            return false;
+        for (size_t i = 0; i < __TASK_END; i++)
+        {
+            if (PLACEMENTS[i].task != i)
+                return false;
+            if (PLACEMENTS[i].priority >= configMAX_PRIORITIES)
+                return false;
+        }
+        return true;
+    }
+    static_assert(placements_valid(), "task placement table must list every task in order with valid priorities");
+
+    /**
+     * @brief creates a statically allocated task at the placement
+     * defined for it in the table
+     *
+     * @param _task which task to create
+     * @param _fn task entry point
+     * @param _stack stack buffer
+     * @param _stack_size size of the stack buffer in bytes (ESP-IDF's FreeRTOS
+     * counts stack depth in bytes, StackType_t is uint8_t)
+     * @param _static_buffer buffer for the task control block
+     * @return TaskHandle_t handle of the created task
+     */
+    TaskHandle_t create_task(
+        task_t _task,
+        TaskFunction_t _fn,
+        StackType_t *_stack,
+        uint32_t _stack_size,
+        StaticTask_t *_static_buffer
+    );
+};
\ No newline at end of file
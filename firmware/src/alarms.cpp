@@ -0,0 +1,102 @@
+/**
+ * @file alarms.cpp
+ * @author melektron
+ * @brief battery alarm evaluation based on the threshold settings
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <atomic>
+
+#include "alarms.hpp"
+#include "settings.hpp"
+#include "utils.hpp"
+#include "log.hpp"
+
+
+namespace alarms    // private
+{
+    static rule_engine<NR_OF_RULES> engine;
+
+    // set when a setting the rules depend on changed
+    static std::atomic<bool> rules_outdated(false);
+
+    /**
+     * @brief builds the rule table from the settings and compiles it
+     */
+    static void compile_rules();
+};
+
+
+void alarms::init()
+{
+    settings::subscribe(
+        settings::make_cell_mask(settings::CELL_WARN_VOLTAGE) |
+        settings::make_cell_mask(settings::CELL_ALARM_VOLTAGE) |
+        settings::make_mask({
+            settings::CELL_ALARM_VOLTAGE_DIFFERENCE,
+            settings::ALARM_HYSTERESIS,
+            settings::ALARM_DEBOUNCE
+        }),
+        [](const settings::key_mask_t &) {
+            rules_outdated = true;
+        }
+    );
+    compile_rules();
+}
+
+alarms::severity_t alarms::evaluate(const int32_t (&_inputs)[NR_OF_INPUTS])
+{
+    // the rule engine belongs to the monitoring task, so the rules
+    // are recompiled here instead of in the settings callback
+    if (rules_outdated.exchange(false))
+        compile_rules();
+
+    return engine.evaluate(_inputs);
+}
+
+void alarms::make_rules(const settings::snapshot_t &_config, rule_t (&_rules)[NR_OF_RULES])
+{
+    const int32_t hysteresis = _config[settings::ALARM_HYSTERESIS];
+    const uint8_t debounce = MIN(MAX(_config[settings::ALARM_DEBOUNCE], 1), UINT8_MAX);
+
+    size_t count = 0;
+    for (size_t cell = 0; cell < env::NR_OF_CELLS; cell++)
+    {
+        _rules[count++] = {
+            .input = (uint8_t)cell,
+            .comparison = BELOW,
+            .severity = WARNING,
+            .debounce = debounce,
+            .threshold = _config[settings::cell_key(settings::CELL_WARN_VOLTAGE, cell)],
+            .hysteresis = hysteresis
+        };
+        _rules[count++] = {
+            .input = (uint8_t)cell,
+            .comparison = BELOW,
+            .severity = ALARM,
+            .debounce = debounce,
+            .threshold = _config[settings::cell_key(settings::CELL_ALARM_VOLTAGE, cell)],
+            .hysteresis = hysteresis
+        };
+    }
+    _rules[count++] = {
+        .input = SPREAD_INPUT,
+        .comparison = ABOVE,
+        .severity = ALARM,
+        .debounce = debounce,
+        .threshold = _config[settings::CELL_ALARM_VOLTAGE_DIFFERENCE],
+        .hysteresis = hysteresis
+    };
+}
+
+static void alarms::compile_rules()
+{
+    rule_t rules[NR_OF_RULES];
+    make_rules(settings::get_all(), rules);
+    engine.compile(rules, NR_OF_RULES);
+    LOGI("Compiled %d alarm rules", (int)NR_OF_RULES);
+}
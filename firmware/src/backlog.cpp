@@ -0,0 +1,518 @@
+/**
+ * @file backlog.cpp
+ * @author melektron
+ * @brief crash safe flash storage for samples that couldn't be sent yet
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <stddef.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <nvs.h>
+
+#include "backlog.hpp"
+#include "utils.hpp"
+#include "log.hpp"
+
+
+namespace backlog   // private
+{
+    // label and subtype of the data partition (see partitions.csv)
+#define PARTITION_LABEL "backlog"
+#define PARTITION_SUBTYPE 0x40
+    // erase unit of the flash
+#define SECTOR_SIZE 4096
+    // marks an initialized sector ("BKLG")
+#define SECTOR_MAGIC 0x424b4c47
+    // layout version of the records, increment when sample_t changes meaning
+    // (a change of its size is detected automatically)
+#define LAYOUT_VERSION 1
+    // value of a flash word that wasn't written since the last erase
+#define ERASED_WORD 0xffffffff
+
+    /**
+     * @brief header at the start of each sector in use
+     */
+    struct sector_header_t
+    {
+        uint32_t magic;
+        // incremented for every sector that is started,
+        // the sector with the highest number is the newest
+        uint32_t sequence;
+        uint16_t version;
+        uint16_t record_size;
+        // CRC32 of the fields above
+        uint32_t crc;
+    };
+
+    /**
+     * @brief one stored sample
+     */
+    struct record_t
+    {
+        // ERASED_WORD until the sample was uploaded, then cleared
+        // without erasing the sector
+        uint32_t uploaded;
+        // CRC32 of the sample
+        uint32_t crc;
+        net::sample_t sample;
+    };
+
+    constexpr size_t RECORDS_PER_SECTOR = (SECTOR_SIZE - sizeof(sector_header_t)) / sizeof(record_t);
+    static_assert(RECORDS_PER_SECTOR >= 1, "samples are too large for the backlog sectors");
+
+    enum record_state_t
+    {
+        RECORD_EMPTY,       // never written
+        RECORD_PENDING,     // written, not uploaded yet (might be corrupted)
+        RECORD_UPLOADED,    // written and uploaded
+    };
+
+    static const esp_partition_t *partition = nullptr;
+    static size_t nr_of_sectors = 0;
+    static uint32_t boot_number = 0;
+
+    // whether any sector is in use
+    static bool in_use = false;
+    // oldest and newest sector in use. All sectors from
+    // tail to head (wrapping around) are in use.
+    static size_t tail_sector = 0;
+    static size_t head_sector = 0;
+    static uint32_t head_sequence = 0;
+    // next free record in the head sector
+    static size_t write_slot = 0;
+    // position up to which all records were uploaded
+    static size_t read_sector = 0;
+    static size_t read_slot = 0;
+
+    static stats_t stats = {};
+
+    /**
+     * @brief loads the boot number from NVS and stores the incremented value
+     */
+    static void update_boot_number();
+
+    /**
+     * @return size_t index of the sector following _sector in the ring
+     */
+    static size_t next_sector(size_t _sector);
+
+    /**
+     * @return size_t offset of a record in the partition
+     */
+    static size_t record_offset(size_t _sector, size_t _slot);
+
+    /**
+     * @brief reads the header of a sector
+     *
+     * @param _sector index of the sector
+     * @param _sequence set to the sequence number of the sector
+     * @return true the sector is in use by the current layout
+     * @return false the sector is erased, corrupted or of a different layout
+     */
+    static bool read_header(size_t _sector, uint32_t &_sequence);
+
+    /**
+     * @brief erases a sector and writes its header
+     *
+     * @param _sector index of the sector
+     * @param _sequence sequence number of the sector
+     */
+    static el::retcode start_sector(size_t _sector, uint32_t _sequence);
+
+    /**
+     * @brief erases a sector, so it is no longer in use
+     */
+    static void erase_sector(size_t _sector);
+
+    /**
+     * @brief erases the sector at the read position (which must not be the
+     * head sector) and moves the read position and tail to the next sector
+     */
+    static void release_read_sector();
+
+    /**
+     * @brief reads a record and determines its state
+     *
+     * @param _record buffer to read the record to
+     */
+    static record_state_t read_record(size_t _sector, size_t _slot, record_t &_record);
+
+    /**
+     * @return size_t number of pending records in a sector starting at _slot
+     */
+    static size_t count_pending(size_t _sector, size_t _slot);
+};
+
+
+el::retcode backlog::init()
+{
+    // start from scratch, everything is recovered from flash
+    partition = nullptr;
+    nr_of_sectors = 0;
+    in_use = false;
+    tail_sector = head_sector = 0;
+    head_sequence = 0;
+    write_slot = 0;
+    read_sector = read_slot = 0;
+    stats = {};
+
+    update_boot_number();
+
+    partition = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)PARTITION_SUBTYPE,
+        PARTITION_LABEL
+    );
+    if (partition == nullptr)
+    {
+        LOGE("No \"%s\" partition, samples are not stored while offline", PARTITION_LABEL);
+        return el::retcode::err;
+    }
+    nr_of_sectors = partition->size / SECTOR_SIZE;
+    if (nr_of_sectors < 2)
+    {
+        LOGE("\"%s\" partition needs at least 2 sectors", PARTITION_LABEL);
+        partition = nullptr;
+        return el::retcode::err;
+    }
+    stats.capacity = (nr_of_sectors - 1) * RECORDS_PER_SECTOR;
+
+    // the newest sector is the one with the highest sequence number
+    uint32_t sequence;
+    for (size_t sector = 0; sector < nr_of_sectors; sector++)
+    {
+        if (!read_header(sector, sequence))
+            continue;
+        if (!in_use || sequence > head_sequence)
+        {
+            head_sector = sector;
+            head_sequence = sequence;
+        }
+        in_use = true;
+    }
+    if (!in_use)
+    {
+        LOGI("Backlog is empty (capacity %d samples)", (int)stats.capacity);
+        return el::retcode::ok;
+    }
+
+    // the sectors in use are the ones before the head with consecutive
+    // sequence numbers, anything else is left over and will be erased
+    // before it is reused
+    tail_sector = head_sector;
+    uint32_t tail_sequence = head_sequence;
+    for (size_t i = 1; i < nr_of_sectors; i++)
+    {
+        size_t previous = (head_sector + nr_of_sectors - i) % nr_of_sectors;
+        if (!read_header(previous, sequence) || sequence != tail_sequence - 1)
+            break;
+        tail_sector = previous;
+        tail_sequence = sequence;
+    }
+
+    // continue writing after the last record written to the head sector
+    // (also if that record is corrupted, as it can't be written again)
+    record_t record;
+    write_slot = 0;
+    for (size_t slot = RECORDS_PER_SECTOR; slot > 0; slot--)
+    {
+        if (read_record(head_sector, slot - 1, record) != RECORD_EMPTY)
+        {
+            write_slot = slot;
+            break;
+        }
+    }
+
+    // find the oldest pending record and count all pending records
+    read_sector = head_sector;
+    read_slot = write_slot;
+    bool read_found = false;
+    for (size_t sector = tail_sector;; sector = next_sector(sector))
+    {
+        for (size_t slot = 0; slot < RECORDS_PER_SECTOR; slot++)
+        {
+            if (read_record(sector, slot, record) != RECORD_PENDING)
+                continue;
+            stats.pending++;
+            if (!read_found)
+            {
+                read_sector = sector;
+                read_slot = slot;
+                read_found = true;
+            }
+        }
+        if (sector == head_sector)
+            break;
+    }
+
+    LOGI("Recovered backlog with %d pending samples (capacity %d samples)", (int)stats.pending, (int)stats.capacity);
+    return el::retcode::ok;
+}
+
+uint32_t backlog::get_boot_number()
+{
+    return boot_number;
+}
+
+el::retcode backlog::push(const net::sample_t &_sample)
+{
+    if (partition == nullptr)
+        return el::retcode::err;
+
+    if (!in_use)
+    {
+        if (start_sector(0, head_sequence + 1) != el::retcode::ok)
+            return el::retcode::err;
+        tail_sector = head_sector = read_sector = 0;
+        head_sequence++;
+        write_slot = read_slot = 0;
+        in_use = true;
+    }
+    else if (write_slot >= RECORDS_PER_SECTOR)
+    {
+        size_t sector = next_sector(head_sector);
+        if (sector == tail_sector)
+        {
+            // full, drop the oldest sector
+            size_t dropped = count_pending(tail_sector, read_sector == tail_sector ? read_slot : 0);
+            stats.dropped += dropped;
+            stats.pending -= dropped;
+            LOGW("Backlog is full, dropped %d samples", (int)dropped);
+            tail_sector = next_sector(tail_sector);
+            if (read_sector == sector)
+            {
+                read_sector = tail_sector;
+                read_slot = 0;
+            }
+        }
+        if (start_sector(sector, head_sequence + 1) != el::retcode::ok)
+            return el::retcode::err;
+        head_sector = sector;
+        head_sequence++;
+        write_slot = 0;
+    }
+
+    record_t record;
+    record.uploaded = ERASED_WORD;
+    record.sample = _sample;
+    record.crc = esp_rom_crc32_le(0, (const uint8_t *)&record.sample, sizeof(record.sample));
+
+    // the uploaded word is left erased, so it can be cleared later
+    size_t offset = record_offset(head_sector, write_slot) + offsetof(record_t, crc);
+    esp_err_t err = esp_partition_write(partition, offset, &record.crc, sizeof(record) - offsetof(record_t, crc));
+    // a failed write may have modified the record, so never use it again
+    write_slot++;
+    if (err != ESP_OK)
+    {
+        LOGE("Failed to write sample to the backlog: %s", esp_err_to_name(err));
+        return el::retcode::err;
+    }
+
+    stats.pending++;
+    stats.stored++;
+    return el::retcode::ok;
+}
+
+size_t backlog::size()
+{
+    return stats.pending;
+}
+
+backlog::cursor_t backlog::begin()
+{
+    return {
+        .sector = read_sector,
+        .slot = read_slot,
+        .passed = 0
+    };
+}
+
+bool backlog::read(cursor_t &_cursor, net::sample_t &_sample)
+{
+    if (!in_use)
+        return false;
+
+    record_t record;
+    for (;;)
+    {
+        if (_cursor.sector == head_sector && _cursor.slot >= write_slot)
+            return false;
+        if (_cursor.slot >= RECORDS_PER_SECTOR)
+        {
+            _cursor.sector = next_sector(_cursor.sector);
+            _cursor.slot = 0;
+            continue;
+        }
+
+        record_state_t state = read_record(_cursor.sector, _cursor.slot, record);
+        _cursor.slot++;
+        if (state != RECORD_PENDING)
+            continue;
+
+        _cursor.passed++;
+        if (record.crc != esp_rom_crc32_le(0, (const uint8_t *)&record.sample, sizeof(record.sample)))
+        {
+            LOGW("Skipping corrupted sample in the backlog");
+            continue;
+        }
+        _sample = record.sample;
+        return true;
+    }
+}
+
+void backlog::consume(const cursor_t &_end)
+{
+    if (!in_use)
+        return;
+
+    // sectors that were read completely are erased
+    while (read_sector != _end.sector)
+        release_read_sector();
+
+    if (_end.slot >= RECORDS_PER_SECTOR && read_sector != head_sector)
+    {
+        release_read_sector();
+    }
+    else
+    {
+        // the records read in the remaining sector are marked individually
+        const uint32_t uploaded = 0;
+        record_t record;
+        for (; read_slot < _end.slot; read_slot++)
+        {
+            if (read_record(read_sector, read_slot, record) != RECORD_PENDING)
+                continue;
+            esp_err_t err = esp_partition_write(
+                partition,
+                record_offset(read_sector, read_slot) + offsetof(record_t, uploaded),
+                &uploaded,
+                sizeof(uploaded)
+            );
+            if (err != ESP_OK)
+                LOGE("Failed to mark sample in the backlog as uploaded: %s", esp_err_to_name(err));
+        }
+    }
+
+    stats.pending -= MIN(_end.passed, stats.pending);
+}
+
+backlog::stats_t backlog::get_stats()
+{
+    return stats;
+}
+
+static void backlog::update_boot_number()
+{
+    nvs_handle_t handle;
+    ESP_ERROR_CHECK(nvs_open("backlog", NVS_READWRITE, &handle));
+
+    uint32_t previous = 0;
+    esp_err_t err = nvs_get_u32(handle, "boot", &previous);
+    if (err != ESP_ERR_NVS_NOT_FOUND)
+        ESP_ERROR_CHECK(err);
+    boot_number = previous + 1;
+
+    ESP_ERROR_CHECK(nvs_set_u32(handle, "boot", boot_number));
+    ESP_ERROR_CHECK(nvs_commit(handle));
+    nvs_close(handle);
+
+    LOGI("Boot number %u", (unsigned)boot_number);
+}
+
+static size_t backlog::next_sector(size_t _sector)
+{
+    return (_sector + 1) % nr_of_sectors;
+}
+
+static size_t backlog::record_offset(size_t _sector, size_t _slot)
+{
+    return _sector * SECTOR_SIZE + sizeof(sector_header_t) + _slot * sizeof(record_t);
+}
+
+static bool backlog::read_header(size_t _sector, uint32_t &_sequence)
+{
+    sector_header_t header;
+    if (esp_partition_read(partition, _sector * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+        return false;
+
+    if (header.magic != SECTOR_MAGIC ||
+        header.version != LAYOUT_VERSION ||
+        header.record_size != sizeof(record_t) ||
+        header.crc != esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(sector_header_t, crc)))
+        return false;
+
+    _sequence = header.sequence;
+    return true;
+}
+
+static el::retcode backlog::start_sector(size_t _sector, uint32_t _sequence)
+{
+    esp_err_t err = esp_partition_erase_range(partition, _sector * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK)
+        goto error;
+
+    sector_header_t header;
+    header.magic = SECTOR_MAGIC;
+    header.sequence = _sequence;
+    header.version = LAYOUT_VERSION;
+    header.record_size = sizeof(record_t);
+    header.crc = esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(sector_header_t, crc));
+    err = esp_partition_write(partition, _sector * SECTOR_SIZE, &header, sizeof(header));
+    if (err != ESP_OK)
+        goto error;
+
+    return el::retcode::ok;
+
+error:
+    LOGE("Failed to start backlog sector %d: %s", (int)_sector, esp_err_to_name(err));
+    return el::retcode::err;
+}
+
+static void backlog::erase_sector(size_t _sector)
+{
+    esp_err_t err = esp_partition_erase_range(partition, _sector * SECTOR_SIZE, SECTOR_SIZE);
+    if (err != ESP_OK)
+        LOGE("Failed to erase backlog sector %d: %s", (int)_sector, esp_err_to_name(err));
+}
+
+static void backlog::release_read_sector()
+{
+    erase_sector(read_sector);
+    read_sector = next_sector(read_sector);
+    read_slot = 0;
+    tail_sector = read_sector;
+}
+
+static backlog::record_state_t backlog::read_record(size_t _sector, size_t _slot, record_t &_record)
+{
+    if (esp_partition_read(partition, record_offset(_sector, _slot), &_record, sizeof(_record)) != ESP_OK)
+        return RECORD_UPLOADED;     // unreadable records are skipped
+
+    if (_record.uploaded != ERASED_WORD)
+        return RECORD_UPLOADED;
+
+    const uint32_t *words = (const uint32_t *)&_record;
+    for (size_t i = 0; i < sizeof(_record) / sizeof(uint32_t); i++)
+    {
+        if (words[i] != ERASED_WORD)
+            return RECORD_PENDING;
+    }
+    return RECORD_EMPTY;
+}
+
+static size_t backlog::count_pending(size_t _sector, size_t _slot)
+{
+    record_t record;
+    size_t count = 0;
+    for (; _slot < RECORDS_PER_SECTOR; _slot++)
+    {
+        if (read_record(_sector, _slot, record) == RECORD_PENDING)
+            count++;
+    }
+    return count;
+}
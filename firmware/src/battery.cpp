@@ -9,69 +9,331 @@
  * 
  */
 
+#include <atomic>
+#include <unistd.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
 #include <esp_adc/adc_continuous.h>
-#include <esp_adc/adc_oneshot.h>
-#include <esp_adc/adc_cali.h>
 
 #include "battery.hpp"
+#include "cell_array.hpp"
+#include "alarms.hpp"
+#include "settings.hpp"
+#include "sag.hpp"
+#include "utils.hpp"
 #include "env.hpp"
+#include "topology.hpp"
 #include "log.hpp"
 
+// number of bytes read from the DMA buffer at once
+#define READ_BUFFER_SIZE 1024
+
+// period in which filtered cell voltages are fed to the runtime predictors
+#define RUNTIME_SAMPLE_PERIOD_S 2
+// number of samples in the regression window (256 * 2 s = ~8.5 min)
+#define RUNTIME_WINDOW_SIZE 256
+// longest time between two DMA frame interrupts before results are
+// considered lost. The DMA keeps writing while the interrupt is blocked
+// and may overwrite results the driver never handed out.
+#define DMA_OVERRUN_GAP_US (2 * env::ADC1_FRAME_PERIOD_US)
+
 
 namespace battery   // private
 {
+    // the statically allocated memory for the task's stack
+#define TASK_STACK_SIZE 3000
+    static StackType_t task_stack[TASK_STACK_SIZE];
+
+    // handle to stack buffer and handle to task
+    static StaticTask_t task_static_buffer;
+    static TaskHandle_t task_handle = nullptr;
+
+    // buffer the sampling task reads DMA conversion results into
+    static uint8_t read_buffer[READ_BUFFER_SIZE];
+
+    // processing stages and published results of all cells
+    static cell_array<NR_OF_CELLS, RUNTIME_WINDOW_SIZE> cells;
+
+    // task to notify about threshold crossings
+    static std::atomic<TaskHandle_t> threshold_notify_task(nullptr);
+
+    // the alarm rules without debounce, used to detect threshold crossings.
+    // They have the same hysteresis, so a value hovering around a threshold
+    // doesn't report a crossing for every DMA frame.
+    static alarms::rule_engine<alarms::NR_OF_RULES> crossing_rules;
+
+    // set by the ADC driver callbacks when conversion results were dropped
+    // because the sampling task didn't read them in time or the DMA
+    // interrupt was blocked for too long
+    static std::atomic<bool> samples_lost(false);
+    // time of the last DMA frame interrupt (ADC driver callback only)
+    static int64_t last_frame_us = 0;
+
+    // settings used by the sampling task, only updated by configure_stages()
+    static settings::snapshot_t config;
+    // set when any setting changed, so the sampling task reconfigures
+    static std::atomic<bool> config_outdated(false);
+
     /**
-     * @brief reads an adc channel multiple times and returns the average.
-     * This could also be achieved more efficiently with the continuous mode 
-     * ADC driver but for this simple use case that would be overkill.
+     * @brief entry point of the sampling task which demultiplexes the
+     * DMA conversion results and feeds them to the processing stages
+     */
+    static void task_fn(void *);
+
+    /**
+     * @brief ADC driver callback (ISR context) called when the
+     * internal pool is full and conversion results are dropped
+     */
+    static bool IRAM_ATTR on_pool_overflow(adc_continuous_handle_t, const adc_continuous_evt_data_t *, void *);
+
+    /**
+     * @brief ADC driver callback (ISR context) called for every DMA frame,
+     * detects frames overrun by the DMA while the interrupt was blocked
+     * (the driver doesn't report this)
+     */
+    static bool IRAM_ATTR on_frame_done(adc_continuous_handle_t, const adc_continuous_evt_data_t *, void *);
+
+    /**
+     * @brief reloads the settings and applies the sampling and
+     * filter settings to all processing stages
+     */
+    static void configure_stages();
+
+    /**
+     * @brief feeds the current filtered voltages to the runtime predictors
+     * and publishes the new predictions
+     */
+    static void update_runtime_predictions();
+
+    /**
+     * @brief compares the filtered values with their thresholds
+     * (with the hysteresis of the alarm rules)
      * 
-     * @param _unit ADC unit to read from
-     * @param _chan ADC channel to read from
-     * @param _n_samples number of sample to read
-     * @return int average ADC value
+     * @return uint32_t bit mask with one bit per exceeded threshold
      */
-    static int adc_read_multisample(
-        adc_oneshot_unit_handle_t _unit, 
-        adc_channel_t _chan, 
-        size_t _n_samples
+    static uint32_t get_threshold_state();
+}
+
+
+void battery::init()
+{
+    settings::subscribe(
+        settings::make_cell_mask(settings::CELL_WARN_VOLTAGE) |
+        settings::make_cell_mask(settings::CELL_ALARM_VOLTAGE) |
+        settings::make_mask({
+            settings::CELL_ALARM_VOLTAGE_DIFFERENCE,
+            settings::ALARM_HYSTERESIS,
+            settings::SAMPLING_CONFIDENCE_BOUND,
+            settings::SAMPLING_MIN_SAMPLES,
+            settings::SAMPLING_MAX_SAMPLES,
+            settings::FILTER_TIME_CONSTANT
+        }),
+        [](const settings::key_mask_t &) {
+            config_outdated = true;
+        }
+    );
+    configure_stages();
+
+    // start the sampling task
+    task_handle = topology::create_task(
+        topology::SAMPLING,
+        task_fn,
+        task_stack,
+        TASK_STACK_SIZE,
+        &task_static_buffer
     );
+
+    const adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = on_frame_done,
+        .on_pool_ovf = on_pool_overflow,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(env::adc1_handle, &callbacks, nullptr));
+    ESP_ERROR_CHECK(adc_continuous_start(env::adc1_handle));
+
+    // wait for the first averages so the readers never see uninitialized values
+    while (!cells.ready())
+        msleep(10);
+}
+
+int battery::read_cell(size_t _cell)
+{
+    return cells.average(_cell);
+}
+
+int battery::read_cell_spread()
+{
+    return cells.average_spread();
+}
+
+int battery::read_filtered_cell(size_t _cell)
+{
+    return cells.filtered(_cell);
+}
+
+int battery::read_filtered_cell_spread()
+{
+    return cells.filtered_spread();
 }
 
+int32_t battery::predict_cell_runtime(size_t _cell)
+{
+    return cells.runtime(_cell);
+}
 
-static int battery::adc_read_multisample(
-    adc_oneshot_unit_handle_t _unit, 
-    adc_channel_t _chan, 
-    size_t _n_samples
-)
+uint32_t battery::get_cell_sample_count(size_t _cell)
 {
-    int sum = 0;
+    return cells.sample_count(_cell);
+}
+
+void battery::notify_on_threshold_crossing(TaskHandle_t _task)
+{
+    threshold_notify_task.store(_task);
+}
+
+static bool IRAM_ATTR battery::on_pool_overflow(adc_continuous_handle_t, const adc_continuous_evt_data_t *, void *)
+{
+    samples_lost.store(true, std::memory_order_relaxed);
+    return false;
+}
+
+static bool IRAM_ATTR battery::on_frame_done(adc_continuous_handle_t, const adc_continuous_evt_data_t *, void *)
+{
+    int64_t now = esp_timer_get_time();
+    if (last_frame_us != 0 && now - last_frame_us > DMA_OVERRUN_GAP_US)
+        samples_lost.store(true, std::memory_order_relaxed);
+    last_frame_us = now;
+    return false;
+}
+
+static void battery::configure_stages()
+{
+    config = settings::get_all();
+
+    cells.configure_estimators(
+        config[settings::SAMPLING_MIN_SAMPLES],
+        config[settings::SAMPLING_MAX_SAMPLES],
+        config[settings::SAMPLING_CONFIDENCE_BOUND]
+    );
+    // the scans for the spread are produced at the cell sample rate as well
+    cells.configure_filters(
+        config[settings::FILTER_TIME_CONSTANT],
+        env::CELL_SAMPLE_PERIOD_US
+    );
 
-    for (size_t sample_index = 0; sample_index < _n_samples; sample_index++)
+    alarms::rule_t rules[alarms::NR_OF_RULES];
+    alarms::make_rules(config, rules);
+    for (alarms::rule_t &rule : rules)
+        rule.debounce = 1;
+    crossing_rules.compile(rules, alarms::NR_OF_RULES);
+}
+
+static void battery::update_runtime_predictions()
+{
+    for (size_t cell = 0; cell < NR_OF_CELLS; cell++)
     {
-        int sample_data;
-        ESP_ERROR_CHECK(adc_oneshot_read(_unit, _chan, &sample_data));
-        sum += sample_data;
+        cells.update_runtime(
+            cell,
+            config[settings::cell_key(settings::CELL_ALARM_VOLTAGE, cell)],
+            RUNTIME_SAMPLE_PERIOD_S
+        );
     }
-
-    return sum / _n_samples;
 }
 
-int battery::read_cell1()
+static uint32_t battery::get_threshold_state()
 {
-    int adc_raw;
-    int adc_voltage;
-    adc_raw = adc_read_multisample(env::adc1_handle, env::c1i_adc_channel, 64);
-    ESP_ERROR_CHECK(adc_cali_raw_to_voltage(env::adc1_calibration_handle, adc_raw, &adc_voltage));
-    LOGD("ADC1 C1I raw data: %4d, voltage: %4d mV", adc_raw, adc_voltage);
-    return adc_voltage * 3;
+    static_assert(alarms::NR_OF_RULES <= 32, "threshold state doesn't fit into the bit mask");
+
+    int32_t inputs[alarms::NR_OF_INPUTS];
+    for (size_t cell = 0; cell < NR_OF_CELLS; cell++)
+        inputs[cell] = cells.filtered(cell);
+    inputs[alarms::SPREAD_INPUT] = cells.filtered_spread();
+    crossing_rules.evaluate(inputs);
+
+    uint32_t state = 0;
+    for (size_t rule = 0; rule < alarms::NR_OF_RULES; rule++)
+        if (crossing_rules.is_active(rule))
+            state |= 1ul << rule;
+
+    return state;
 }
 
-int battery::read_cell2()
+static void battery::task_fn(void *)
 {
-    int adc_raw;
-    int adc_voltage;
-    adc_raw = adc_read_multisample(env::adc1_handle, env::c2i_adc_channel, 64);
-    ESP_ERROR_CHECK(adc_cali_raw_to_voltage(env::adc1_calibration_handle, adc_raw, &adc_voltage));
-    LOGD("ADC1 C2I raw data: %4d, voltage: %4d mV", adc_raw, adc_voltage);
-    return adc_voltage * 3;
-}
\ No newline at end of file
+    // threshold state at the last check, to detect crossings
+    uint32_t last_threshold_state = 0;
+
+    // number of scans since the runtime predictors were last updated
+    uint32_t runtime_sample_counter = 0;
+
+    for (;;)
+    {
+        uint32_t bytes_read = 0;
+        esp_err_t err = adc_continuous_read(
+            env::adc1_handle,
+            read_buffer,
+            READ_BUFFER_SIZE,
+            &bytes_read,
+            ADC_MAX_DELAY
+        );
+        if (err != ESP_OK)
+        {
+            LOGE("Failed to read ADC conversion results: %s", esp_err_to_name(err));
+            cells.reset_scan();
+            continue;
+        }
+
+        // the results before and after dropped ones aren't from the same
+        // scan. Where exactly the gap is isn't known, so this may discard
+        // one more valid scan, which doesn't matter.
+        if (samples_lost.exchange(false, std::memory_order_relaxed))
+            cells.reset_scan();
+
+        // the driver hands out a frame as soon as its last conversion is
+        // done, so the time of each conversion can be derived from its
+        // position in the frame (late by the scheduling latency of this task)
+        int64_t buffer_end_us = esp_timer_get_time();
+        uint32_t nr_of_results = bytes_read / SOC_ADC_DIGI_RESULT_BYTES;
+        // the same tables for the whole frame, see env::update_adc_lut()
+        const env::cell_voltage_lut_t &lut = *env::cell_voltage_lut.load(std::memory_order_acquire);
+
+        for (uint32_t i = 0; i < nr_of_results; i++)
+        {
+            const adc_digi_output_data_t *result = (const adc_digi_output_data_t *)&read_buffer[i * SOC_ADC_DIGI_RESULT_BYTES];
+            int cell = env::CHANNEL_TO_CELL[result->type1.channel];
+            if (cell < 0)
+                continue;
+
+            int voltage = lut[cell][result->type1.data];
+            sag::feed(cell, voltage, buffer_end_us - (int64_t)(nr_of_results - 1 - i) * env::ADC1_CONVERSION_PERIOD_US);
+            cells.add_sample(cell, voltage);
+
+            // count scans by their first cell
+            if (cell == 0 && ++runtime_sample_counter >= env::CELL_SAMPLE_FREQ_HZ * RUNTIME_SAMPLE_PERIOD_S)
+            {
+                runtime_sample_counter = 0;
+                update_runtime_predictions();
+            }
+        }
+
+        // pick up changed settings
+        if (config_outdated.exchange(false))
+            configure_stages();
+
+        // wake up the registered task if any threshold was crossed
+        uint32_t threshold_state = get_threshold_state();
+        if (threshold_state != last_threshold_state)
+        {
+            last_threshold_state = threshold_state;
+            TaskHandle_t notify_task = threshold_notify_task.load();
+            if (notify_task != nullptr)
+                xTaskNotifyGive(notify_task);
+        }
+    }
+
+    // set to nullptr before deleting, as any code after this line
+    // is not run and the variable isn't referenced here anyway
+    task_handle = nullptr;
+    vTaskDelete(NULL);
+}
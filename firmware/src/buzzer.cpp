@@ -18,6 +18,7 @@
 #include "pitches.h"
 #include "utils.hpp"
 #include "env.hpp"
+#include "topology.hpp"
 #include "log.hpp"
 
 
@@ -106,13 +107,11 @@ void buzzer::init()
     ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
 
     // start the buzzer task
-    task_handle = xTaskCreateStatic(
+    task_handle = topology::create_task(
+        topology::BUZZER,
         task_fn,
-        "buzzer",
-        TASK_STACK_SIZE,
-        nullptr,
-        1,
         task_stack,
+        TASK_STACK_SIZE,
         &task_static_buffer
     );
 }
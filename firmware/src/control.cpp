@@ -0,0 +1,187 @@
+/**
+ * @file control.cpp
+ * @author melektron
+ * @brief downlink for server driven configuration
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <inttypes.h>
+#include <nlohmann/json.hpp>
+
+#include "control.hpp"
+#include "settings.hpp"
+#include "log.hpp"
+
+
+namespace control   // private
+{
+    /**
+     * @brief SAX handler that stages all integer members of the top level
+     * "settings" object in a settings transaction and skips everything else
+     */
+    class message_handler : public nlohmann::json_sax<nlohmann::json>
+    {
+        // nesting depth of objects and arrays (1 = top level object)
+        int depth = 0;
+        // whether the last top level key was "settings"
+        bool settings_key = false;
+        // whether the top level "settings" object is open
+        bool settings_open = false;
+        // setting the next value belongs to, if known
+        bool setting_known = false;
+        settings::key_t setting;
+
+        /**
+         * @return true if the next value is a member of the settings object
+         */
+        bool is_setting_value() const
+        {
+            return settings_open && depth == 2 && setting_known;
+        }
+
+        /**
+         * @brief stages a value if it is a setting value, otherwise
+         * it is ignored
+         */
+        bool value(int64_t _value)
+        {
+            if (!is_setting_value())
+                return true;
+
+            if (_value < INT32_MIN || _value > INT32_MAX || !transaction.set(setting, (int32_t)_value))
+                LOGW("Ignoring invalid value for setting %s", settings::get_name(setting));
+            else
+                staged_count++;
+            return true;
+        }
+
+        /**
+         * @brief ignores a value that cannot be a setting value
+         */
+        bool other_value()
+        {
+            if (is_setting_value())
+                LOGW("Ignoring non integer value for setting %s", settings::get_name(setting));
+            return true;
+        }
+
+    public:
+        settings::transaction transaction;
+        // number of values staged in the transaction
+        size_t staged_count = 0;
+
+        bool null() override
+        {
+            return other_value();
+        }
+
+        bool boolean(bool) override
+        {
+            return other_value();
+        }
+
+        bool number_integer(number_integer_t _value) override
+        {
+            return value(_value);
+        }
+
+        bool number_unsigned(number_unsigned_t _value) override
+        {
+            return value(_value > INT64_MAX ? INT64_MAX : (int64_t)_value);
+        }
+
+        bool number_float(number_float_t, const string_t &) override
+        {
+            return other_value();
+        }
+
+        bool string(string_t &) override
+        {
+            return other_value();
+        }
+
+        bool binary(binary_t &) override
+        {
+            return other_value();
+        }
+
+        bool start_object(size_t) override
+        {
+            other_value();
+            if (depth == 1 && settings_key)
+                settings_open = true;
+            depth++;
+            return true;
+        }
+
+        bool key(string_t &_key) override
+        {
+            if (depth == 1)
+            {
+                settings_key = _key == "settings";
+            }
+            else if (settings_open && depth == 2)
+            {
+                setting_known = settings::find_key(_key.c_str(), setting);
+                if (!setting_known)
+                    LOGW("Ignoring unknown setting %s", _key.c_str());
+            }
+            return true;
+        }
+
+        bool end_object() override
+        {
+            depth--;
+            if (depth == 1)
+                settings_open = false;
+            return true;
+        }
+
+        bool start_array(size_t) override
+        {
+            other_value();
+            depth++;
+            return true;
+        }
+
+        bool end_array() override
+        {
+            depth--;
+            return true;
+        }
+
+        bool parse_error(size_t _position, const std::string &, const nlohmann::detail::exception &) override
+        {
+            LOGE("Control message is invalid JSON (at byte %d)", (int)_position);
+            return false;
+        }
+    };
+};
+
+
+el::retcode control::apply_message(const char *_data, size_t _length)
+{
+    if (_length == 0)
+        return el::retcode::ok;
+
+    message_handler handler;
+    if (!nlohmann::json::sax_parse(_data, _data + _length, &handler))
+        return el::retcode::err;
+
+    if (handler.staged_count > 0)
+    {
+        size_t changes;
+        if (!handler.transaction.commit(&changes))
+        {
+            LOGW("Ignoring control message, its settings are inconsistent");
+            return el::retcode::err;
+        }
+        LOGI("Applied control message, %d of %d settings changed", (int)changes, (int)handler.staged_count);
+    }
+
+    return el::retcode::ok;
+}
@@ -9,12 +9,16 @@
  * 
  */
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <driver/gpio.h>
-#include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_continuous.h>
 #include <esp_adc/adc_cali.h>
 #include <esp_adc/adc_cali_scheme.h>
 
 #include "env.hpp"
+#include "settings.hpp"
+#include "log.hpp"
 
 // GPIO Outputs
 const gpio_num_t env::BUZZER = GPIO_NUM_14;
@@ -23,16 +27,25 @@ const gpio_num_t env::LED = GPIO_NUM_26;
 // GPIO Inputs
 const gpio_num_t env::WRONG_C1I = GPIO_NUM_16;
 const gpio_num_t env::WRONG_C2I = GPIO_NUM_17;
-const gpio_num_t env::C1I = GPIO_NUM_35;
-const gpio_num_t env::C2I = GPIO_NUM_34;
 
 // ADC 
 #define USED_ADC1_ATTENUATION adc_atten_t::ADC_ATTEN_DB_11
 #define USED_ADC1_BITWIDTH adc_bitwidth_t::ADC_BITWIDTH_DEFAULT
-adc_oneshot_unit_handle_t env::adc1_handle;
+// size of one DMA conversion frame in bytes
+#define ADC1_CONV_FRAME_SIZE (env::ADC1_FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES)
+adc_continuous_handle_t env::adc1_handle;
 adc_cali_handle_t env::adc1_calibration_handle;
-adc_channel_t env::c1i_adc_channel;
-adc_channel_t env::c2i_adc_channel;
+// time after swapping the lookup tables until the old ones are no longer
+// read: the sampling task uses the tables it loaded for one frame, which
+// it has processed long before the next frame is done
+#define ADC_LUT_RETIRE_DELAY_MS (2 * env::ADC1_FRAME_PERIOD_US / 1000)
+std::atomic<const env::cell_voltage_lut_t *> env::cell_voltage_lut(nullptr);
+
+namespace env   // private
+{
+    // the published lookup tables and the ones the next update is built in
+    static cell_voltage_lut_t lut_buffers[2];
+};
 
 void env::init_gpio()
 {
@@ -47,7 +60,9 @@ void env::init_gpio()
     gpio_config(&io_conf);
 
     // Input Pins
-    io_conf.pin_bit_mask = (1ull << env::WRONG_C1I) | (1ull << env::WRONG_C2I) | (1ull << env::C1I) | (1ull << env::C2I);
+    io_conf.pin_bit_mask = (1ull << env::WRONG_C1I) | (1ull << env::WRONG_C2I);
+    for (const cell_input_t &input : CELL_INPUTS)
+        io_conf.pin_bit_mask |= 1ull << input.gpio;
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
@@ -57,25 +72,43 @@ void env::init_gpio()
 
 void env::init_adc()
 {
-    // initialize ADC1
-    const adc_oneshot_unit_init_cfg_t init_config1 = {
-        .unit_id = adc_unit_t::ADC_UNIT_1,
-        .ulp_mode = adc_ulp_mode_t::ADC_ULP_MODE_DISABLE,
+    // initialize ADC1 in continuous mode
+    const adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC1_CONV_FRAME_SIZE * 4,
+        .conv_frame_size = ADC1_CONV_FRAME_SIZE,
     };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc1_handle));
 
-    // initialize all needed ADC channels
-    const adc_oneshot_chan_cfg_t config = {
-        .atten = USED_ADC1_ATTENUATION,
-        .bitwidth = USED_ADC1_BITWIDTH
-    };
-    // we don't need the unit result of adc_oneshot_io_to_channel so we store it here
-    adc_unit_t unit;
+    // conversion pattern converting all cell inputs one after the other,
+    // so the DMA buffer is filled with interleaved results of all cells
+    adc_digi_pattern_config_t pattern[NR_OF_CELLS];
+    for (size_t cell = 0; cell < NR_OF_CELLS; cell++)
+    {
+        // make sure the channel in the cell input table matches the GPIO
+        adc_unit_t unit;
+        adc_channel_t channel;
+        ESP_ERROR_CHECK(adc_continuous_io_to_channel(CELL_INPUTS[cell].gpio, &unit, &channel));
+        if (unit != ADC_UNIT_1 || channel != CELL_INPUTS[cell].channel)
+        {
+            LOGE("Cell input %d (GPIO %d) is not ADC1 channel %d", (int)cell + 1, (int)CELL_INPUTS[cell].gpio, (int)CELL_INPUTS[cell].channel);
+            ESP_ERROR_CHECK(ESP_ERR_INVALID_ARG);
+        }
 
-    ESP_ERROR_CHECK(adc_oneshot_io_to_channel(env::C1I, &unit, &c1i_adc_channel));
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, c1i_adc_channel, &config));
-    ESP_ERROR_CHECK(adc_oneshot_io_to_channel(env::C2I, &unit, &c2i_adc_channel));
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, c2i_adc_channel, &config));
+        pattern[cell] = {
+            .atten = USED_ADC1_ATTENUATION,
+            .channel = static_cast<uint8_t>(CELL_INPUTS[cell].channel),
+            .unit = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH
+        };
+    }
+    const adc_continuous_config_t config = {
+        .pattern_num = NR_OF_CELLS,
+        .adc_pattern = pattern,
+        .sample_freq_hz = ADC1_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc1_handle, &config));
 
     // apply line fitting calibration
     const adc_cali_line_fitting_config_t cali_config = {
@@ -86,5 +119,33 @@ void env::init_adc()
     };
     ESP_ERROR_CHECK(adc_cali_create_scheme_line_fitting(&cali_config, &adc1_calibration_handle));
 
-    
-}
\ No newline at end of file
+    update_adc_lut();
+    settings::subscribe(
+        settings::make_cell_mask(settings::CELL_VOLTAGE_CORRECTION),
+        [](const settings::key_mask_t &) {
+            update_adc_lut();
+        }
+    );
+}
+
+void env::update_adc_lut()
+{
+    const cell_voltage_lut_t *current = cell_voltage_lut.load(std::memory_order_relaxed);
+    cell_voltage_lut_t &next = current == &lut_buffers[0] ? lut_buffers[1] : lut_buffers[0];
+
+    for (size_t cell = 0; cell < NR_OF_CELLS; cell++)
+    {
+        const int correction = settings::get(settings::cell_key(settings::CELL_VOLTAGE_CORRECTION, cell));
+
+        for (size_t raw = 0; raw < ADC_LUT_SIZE; raw++)
+        {
+            int adc_voltage;
+            ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc1_calibration_handle, raw, &adc_voltage));
+            next[cell][raw] = cell_voltage_from_adc(adc_voltage, CELL_INPUTS[cell].divider_ratio, correction);
+        }
+    }
+
+    cell_voltage_lut.store(&next, std::memory_order_release);
+    if (current != nullptr)
+        vTaskDelay(pdMS_TO_TICKS(ADC_LUT_RETIRE_DELAY_MS) + 1);
+}
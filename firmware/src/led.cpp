@@ -16,6 +16,7 @@
 #include "led.hpp"
 #include "env.hpp"
 #include "utils.hpp"
+#include "topology.hpp"
 #include "log.hpp"
 
 namespace led // private
@@ -61,13 +62,11 @@ void led::init()
     set_permanent_off();
 
     // start the led task
-    task_handle = xTaskCreateStatic(
+    task_handle = topology::create_task(
+        topology::LED,
         task_fn,
-        "led",
-        TASK_STACK_SIZE,
-        nullptr,
-        1,
         task_stack,
+        TASK_STACK_SIZE,
         &task_static_buffer
     );
 }
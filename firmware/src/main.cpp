@@ -10,29 +10,61 @@
  */
 
 #include <stdbool.h>
+#include <limits.h>
 #include <unistd.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_heap_trace.h>
-#include <esp_adc/adc_oneshot.h>
 #include <esp_adc/adc_cali.h>
 #include <esp_adc/adc_cali_scheme.h>
 
 #include "settings.hpp"
 #include "battery.hpp"
+#include "scheduler.hpp"
+#include "alarms.hpp"
+#include "soc.hpp"
 #include "buzzer.hpp"
 #include "utils.hpp"
 #include "log.hpp"
 #include "env.hpp"
 #include "led.hpp"
 #include "net.hpp"
+#include "sag.hpp"
+#include "topology.hpp"
 
 // variables used for heap tracing during debug mode
 #define HEAP_TRACE_NUM_RECORDS 100
 static heap_trace_record_t heap_trace_record_buffer[HEAP_TRACE_NUM_RECORDS];
 
+// the statically allocated memory for the monitoring task's stack
+#define MONITORING_TASK_STACK_SIZE 4096
+static StackType_t monitoring_task_stack[MONITORING_TASK_STACK_SIZE];
+static StaticTask_t monitoring_task_static_buffer;
 
+/**
+ * @brief entry point of the monitoring task which periodically
+ * evaluates the alarm rules and publishes reports. This runs in its own
+ * task instead of app_main so it can be placed on the APP core next to
+ * the sampling task (app_main is pinned to the PRO core by sdkconfig).
+ */
+static void monitoring_task_fn(void *);
+
+/**
+ * @brief initializes all modules and hands over to the monitoring task.
+ * The on-target tests (test/embedded) have their own app_main and start
+ * the firmware with this.
+ */
+void start_firmware();
+
+
+#ifndef PIO_UNIT_TESTING
 extern "C" void app_main()
+{
+    start_firmware();
+}
+#endif
+
+void start_firmware()
 {
     LOGI("=== BatMon Firmware v0.1 starting ===");
     LOGI("Initializing heap tracing");
@@ -47,6 +79,15 @@ extern "C" void app_main()
     LOGI("Initializing ADC");
     env::init_adc();
 
+    LOGI("Initializing sag capture");
+    sag::init();
+
+    LOGI("Initializing battery sampling");
+    battery::init();
+
+    LOGI("Initializing alarm rules");
+    alarms::init();
+
     LOGI("Initializing LED blink controller");
     led::init();
 
@@ -61,36 +102,90 @@ extern "C" void app_main()
     buzzer::play_startup();
     msleep(500);
 
-
+    // hand over to the monitoring task, app_main's task is deleted on return
+    topology::create_task(
+        topology::MONITORING,
+        monitoring_task_fn,
+        monitoring_task_stack,
+        MONITORING_TASK_STACK_SIZE,
+        &monitoring_task_static_buffer
+    );
+}
+
+static void monitoring_task_fn(void *)
+{
+    // get woken up immediately when a threshold is crossed
+    battery::notify_on_threshold_crossing(xTaskGetCurrentTaskHandle());
+    // or when the thresholds or the monitoring interval are changed
+    settings::subscribe(
+        settings::make_cell_mask(settings::CELL_WARN_VOLTAGE) |
+        settings::make_cell_mask(settings::CELL_ALARM_VOLTAGE) |
+        settings::make_mask({
+            settings::CELL_ALARM_VOLTAGE_DIFFERENCE,
+            settings::MONITOR_MIN_INTERVAL,
+            settings::MONITOR_MAX_INTERVAL,
+            settings::MONITOR_SLOW_MARGIN
+        }),
+        xTaskGetCurrentTaskHandle()
+    );
+
+    // severity of the previous cycle, changes are reported immediately
+    alarms::severity_t previous_severity = alarms::NONE;
 
     for (;;)
     {
-        int c1_voltage = battery::read_cell1();
-        int c2_voltage = battery::read_cell2();
-        LOGI("C1 (L): %1.2f V,\tC2 (H): %1.2f", c1_voltage * 0.001, c2_voltage * 0.001);
-
-        net::report.c1_voltage = c1_voltage;
-        net::report.c2_voltage = c2_voltage;
-        net::report.c1_warn_threshold = settings::get(settings::CELL1_WARN_VOLTAGE);
-        net::report.c2_warn_threshold = settings::get(settings::CELL2_WARN_VOLTAGE);
-        net::report.c1_alarm_threshold = settings::get(settings::CELL1_ALARM_VOLTAGE);
-        net::report.c2_alarm_threshold = settings::get(settings::CELL2_ALARM_VOLTAGE);
-        net::report.diff_alarm_threshold = settings::get(settings::CELL_ALARM_VOLTAGE_DIFFERENCE);
-        net::update();
-
-        if (
-            c1_voltage < settings::get(settings::CELL1_ALARM_VOLTAGE) ||
-            c2_voltage < settings::get(settings::CELL2_ALARM_VOLTAGE) ||
-            abs(c1_voltage - c2_voltage) > settings::get(settings::CELL_ALARM_VOLTAGE_DIFFERENCE)
-            ) {
+        TickType_t cycle_start = xTaskGetTickCount();
+
+        // report to the server
+        net::report_t report;
+        // input values for the alarm rules
+        int32_t alarm_inputs[alarms::NR_OF_INPUTS];
+        // smallest distance of any value to its warning threshold
+        int headroom = INT_MAX;
+        // all thresholds of this cycle from the same settings transaction
+        const settings::snapshot_t config = settings::get_all();
+
+        for (size_t cell = 0; cell < battery::NR_OF_CELLS; cell++)
+        {
+            int voltage = battery::read_filtered_cell(cell);
+            int warn_threshold = config[settings::cell_key(settings::CELL_WARN_VOLTAGE, cell)];
+            int alarm_threshold = config[settings::cell_key(settings::CELL_ALARM_VOLTAGE, cell)];
+            LOGI("C%d: %1.2f V", (int)cell + 1, voltage * 0.001);
+
+            net::cell_report_t &cell_report = report.cells[cell];
+            cell_report.voltage = voltage;
+            cell_report.warn_threshold = warn_threshold;
+            cell_report.alarm_threshold = alarm_threshold;
+            cell_report.sample_count = battery::get_cell_sample_count(cell);
+            cell_report.soc = battery::soc::from_voltage(voltage);
+            cell_report.runtime = battery::predict_cell_runtime(cell);
+
+            alarm_inputs[cell] = voltage;
+            headroom = MIN(headroom, voltage - warn_threshold);
+        }
+
+        int cell_spread = battery::read_filtered_cell_spread();
+        int diff_alarm_threshold = config[settings::CELL_ALARM_VOLTAGE_DIFFERENCE];
+        alarm_inputs[alarms::SPREAD_INPUT] = cell_spread;
+        headroom = MIN(headroom, diff_alarm_threshold - cell_spread);
+
+        report.cell_spread = cell_spread;
+        report.diff_alarm_threshold = diff_alarm_threshold;
+        net::update(report);
+
+        alarms::severity_t severity = alarms::evaluate(alarm_inputs);
+        // don't wait for the batch to complete when an alarm is raised or released
+        if (severity != previous_severity)
+            net::flush();
+        previous_severity = severity;
+        if (severity == alarms::ALARM)
+        {
             buzzer::play_battery_alarm();
             led::set_blink_alarm();
             LOGI("Battery alarm");
         }
-        else if (
-            c1_voltage < settings::get(settings::CELL1_WARN_VOLTAGE) ||
-            c2_voltage < settings::get(settings::CELL2_WARN_VOLTAGE)
-            ) {
+        else if (severity == alarms::WARNING)
+        {
             buzzer::play_battery_warning();
             led::set_blink_warning();
             LOGI("Battery warning");
@@ -102,7 +197,21 @@ extern "C" void app_main()
             LOGI("All good");
         }
 
-        sleep(10);
+        // sleep until the next cycle is due or the sampling task
+        // reports a threshold crossing
+        const scheduler::policy_t policy = {
+            .min_interval_ms = config[settings::MONITOR_MIN_INTERVAL],
+            .max_interval_ms = config[settings::MONITOR_MAX_INTERVAL],
+            .slow_margin_mv = config[settings::MONITOR_SLOW_MARGIN]
+        };
+        int interval = scheduler::next_interval(headroom, policy);
+        LOGD("Next monitoring cycle in %d ms", interval);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval));
+
+        // but never closer together than the minimum interval
+        int delay = scheduler::wake_delay((xTaskGetTickCount() - cycle_start) * portTICK_PERIOD_MS, policy);
+        if (delay > 0)
+            vTaskDelay(pdMS_TO_TICKS(delay));
     }
 
 
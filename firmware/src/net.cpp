@@ -16,9 +16,21 @@
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_tls.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include <esp_http_client.h>    // "esp32_mock.h" not found is only an intellisense error, ignore it.
+#include <lwip/netdb.h>
 #include <nlohmann/json.hpp>
 #include "net.hpp"
+#include "spsc_queue.hpp"
+#include "resolve_cache.hpp"
+#include "backlog.hpp"
+#include "sample_encoding.hpp"
+#include "sag.hpp"
+#include "settings.hpp"
+#include "control.hpp"
+#include "topology.hpp"
+#include "utils.hpp"
 #include "log.hpp"
 
 /**
@@ -32,14 +44,62 @@
 // interval of try reconnecting after immediate reconnect attempts fail (seconds)
 #define WIFI_RECONNECT_LONG_PERIOD 30
 
-// maximum size of HTTP responses (any bigger will not be stored)
-#define HTTP_RESPONSE_MAX_LEN 500
+// maximum size of HTTP responses (any bigger will not be stored),
+// enough for a control message changing every setting
+#define HTTP_RESPONSE_MAX_LEN 1024
+// server all requests are sent to. The on-target tests run a
+// stand-in server on the device itself.
+#ifdef PIO_UNIT_TESTING
+#define SERVER_HOST "127.0.0.1"
+#else
+#define SERVER_HOST "elektronlab.local"
+#endif
+#define SERVER_PORT 8080
+// Host header of all requests. The URL contains the cached address
+// instead of the host name, so the header has to be set explicitly.
+#define SERVER_HOST_HEADER SERVER_HOST ":8080"
+static_assert(SERVER_PORT == 8080, "update SERVER_HOST_HEADER to the new port");
+// base path of all requests to the server
+#define SERVER_PATH "/devtools/http/batt1"
+// maximum length of a request URL
+#define URL_MAX_LEN 128
+// how long a resolved server address is used before resolving again (seconds)
+#define RESOLVE_TTL 600
+// how long before the address expires it is refreshed in the background (seconds)
+#define RESOLVE_REFRESH_MARGIN 60
+// timeout of a single HTTP request (ms)
+#define HTTP_TIMEOUT_MS 5000
+
+// number of samples that can be queued for sending
+#define SAMPLE_QUEUE_DEPTH 32
+// maximum number of samples taken from the queue for one report, they are
+// kept until the upload succeeded so they can go to the backlog if it fails
+#define REPORT_MAX_SAMPLES SAMPLE_QUEUE_DEPTH
+// upper bound of the JSON text of the report apart from the samples
+// (~800 characters with all statistics at their maximum length)
+#define REPORT_JSON_OVERHEAD 1024
+// upper bound of the CBOR encoding of the report apart from the samples
+// (the statistics keep their names, ~580 bytes)
+#define REPORT_CBOR_OVERHEAD 768
+// size of the buffer reports are serialized into. Samples that might not
+// fit stay queued for the next report.
+#define REPORT_BUFFER_SIZE 8192
+// what to do when samples are produced faster than they can be sent
+#define SAMPLE_QUEUE_OVERFLOW_POLICY concurrency::overflow_policy_t::DROP_OLDEST
+// minimum time between two uploads of samples from the backlog, so
+// draining a large backlog doesn't hog the network and the server (ms)
+#define BACKLOG_UPLOAD_INTERVAL_MS 1000
+// time until an upload is retried after it failed, doubled after every
+// further failure up to the maximum (ms). Every attempt against a dead
+// server costs up to HTTP_TIMEOUT_MS.
+#define UPLOAD_RETRY_MIN_MS 2000
+#define UPLOAD_RETRY_MAX_MS 300000
 
 
 namespace net   // private
 {
-    // the report data
-    report_t report;
+    // samples published by the monitoring loop waiting to be sent
+    static concurrency::spsc_queue<sample_t, SAMPLE_QUEUE_DEPTH> sample_queue(SAMPLE_QUEUE_OVERFLOW_POLICY);
 
     // event group used to notify the networking application task
     // about the wifi state from event handlers
@@ -49,6 +109,7 @@ namespace net   // private
 #define WIFI_DISCONNECTED_BIT       BIT1
 #define WIFI_RECONNECT_LATER_BIT    BIT2
 #define REPORT_READY_FOR_SEND_BIT   BIT3
+#define FLUSH_REPORT_BIT            BIT4
 
     // the statically allocated memory for the task's stack
 #define TASK_STACK_SIZE 10000   // networking task needs a bit more stack space
@@ -58,6 +119,73 @@ namespace net   // private
     static StaticTask_t task_static_buffer;
     static TaskHandle_t task_handle = nullptr;
 
+    /**
+     * @brief resolves a host name using lwIP (which also
+     * resolves .local names using mDNS)
+     */
+    static bool resolve_host(const char *_host, uint32_t &_address);
+
+    // address of the server, so it doesn't have to be resolved for every request
+    static resolve_cache server_address(
+        SERVER_HOST,
+        resolve_host,
+        RESOLVE_TTL * 1000000LL,
+        RESOLVE_REFRESH_MARGIN * 1000000LL
+    );
+
+    // HTTP client kept open across requests so the connection to the
+    // server (and the DNS resolution) can be reused (networking task only)
+    static esp_http_client_handle_t http_client = nullptr;
+    // buffer the response of the last request is stored in
+    static char http_response_buffer[HTTP_RESPONSE_MAX_LEN + 1];
+    // number of bytes in the response buffer
+    static size_t http_response_length = 0;
+    // whether the response didn't fit into the buffer
+    static bool http_response_truncated = false;
+    // buffer the report is serialized into
+    static char report_buffer[REPORT_BUFFER_SIZE];
+    // samples taken from the queue for the report being sent
+    static sample_t report_samples[REPORT_MAX_SAMPLES];
+    // number of the current boot, read from the backlog once in init(), so
+    // update() (monitoring task) never calls into the backlog
+    static uint32_t boot_number = 0;
+
+    /**
+     * @brief durations of HTTP requests of one kind
+     */
+    struct latency_stats_t
+    {
+        uint32_t count;             // requests measured
+        int64_t total_us;           // sum of all durations
+        int64_t max_us;             // longest duration
+    };
+
+    /**
+     * @brief statistics of the HTTP requests. Requests on a new connection
+     * cost what every request cost before the client was kept open, so
+     * comparing them with the ones on a reused connection shows the saving.
+     * samples / sample_requests shows how many requests batching saves.
+     */
+    struct http_stats_t
+    {
+        uint32_t requests;          // requests performed
+        uint32_t connections;       // clients created (=connections opened at least)
+        uint32_t retries;           // requests repeated on a new connection
+        uint32_t sample_requests;   // requests that uploaded samples
+        uint32_t samples;           // samples uploaded by these requests
+        latency_stats_t new_connection;     // attempts that had to connect first
+        latency_stats_t reused_connection;  // attempts on a kept-alive connection
+        int64_t last_latency_us;    // duration of the last request
+        int32_t last_heap_delta;    // change of free heap during the last request
+        int32_t max_heap_drop;      // largest decrease of free heap during a request
+    };
+    static http_stats_t http_stats = {};
+
+    /**
+     * @brief adds the duration of a request to latency statistics
+     */
+    static void add_latency(latency_stats_t &_stats, int64_t _latency_us);
+
     /**
      * @brief entry point for the networking application task
      */
@@ -81,12 +209,116 @@ namespace net   // private
     );
 
     /**
-     * @brief sends a battery status report to the server using http
+     * @brief closes the persistent HTTP client, the next
+     * request will reconnect
+     */
+    static void reset_http_client();
+
+    /**
+     * @brief POSTs data to the server using the persistent HTTP client.
+     * If a reused connection turns out to be dead (e.g. closed by the server)
+     * before the request was sent, the request is retried once on a new
+     * connection. Requests failing later (e.g. while waiting for the
+     * response) are not repeated, as the server may have processed them.
+     * The response body (also a chunked one) is stored in http_response_buffer,
+     * http_response_truncated is set if it didn't fit.
+     *
+     * @param _path path on the server to post to (appended to SERVER_PATH)
+     * @param _content_type value of the Content-Type header
+     * @param _data request body
+     * @param _length length of the request body
+     * @retval ok - request was sent and the server responded with 200
+     * @retval err - request failed or the server responded with an error
+     */
+    static el::retcode post(const char *_path, const char *_content_type, const char *_data, size_t _length);
+
+    /**
+     * @brief moves all queued samples to the flash backlog, so they are
+     * kept until they can be uploaded
+     */
+    static void store_samples();
+
+    /**
+     * @brief stores samples in the flash backlog (if there is one)
+     *
+     * @param _samples the samples to store (oldest first)
+     * @param _count number of samples
+     */
+    static void store_samples(const sample_t *_samples, size_t _count);
+
+    /**
+     * @return size_t space a sample and the rest of the report need at most
+     * in the encoding of the writer
+     */
+    constexpr size_t report_reserve(const json_writer &)
+    {
+        return SAMPLE_JSON_MAX_LEN + REPORT_JSON_OVERHEAD;
+    }
+    constexpr size_t report_reserve(const cbor_writer &)
+    {
+        return SAMPLE_CBOR_MAX_LEN + REPORT_CBOR_OVERHEAD;
+    }
+
+    /**
+     * @brief writes a report containing as many samples as fit into the writer
+     *
+     * @param _writer json_writer or cbor_writer
+     * @param _next_sample function bool(sample_t &) providing the samples, it is
+     * only called if the sample fits, so the rest stays where it came from
+     * @return size_t number of samples written (nothing else
+     * is written if this is 0)
+     */
+    template <typename W, typename S>
+    static size_t write_report(W &_writer, S &_next_sample);
+
+    /**
+     * @brief sends a report with samples provided by _next_sample to the
+     * server in one http request using the encoding selected by the
+     * REPORT_ENCODING setting and applies the control message in the response
+     *
+     * @param _next_sample see write_report()
+     * @retval ok - request was sent (or there were no samples)
+     * @retval err - couldn't send request because not connected or connection interrupted
+     */
+    template <typename S>
+    static el::retcode send_samples(S &_next_sample);
+
+    /**
+     * @brief sends all queued samples to the server in one http request
+     * (as many as fit, the rest is sent with the next report)
      * 
      * @retval ok - request was sent
-     * @retval err - couldn't send request because not connected or connection interrupted
+     * @retval err - couldn't send request because not connected or connection interrupted,
+     * the samples in the request are moved to the backlog (lost if there is none)
      */
     el::retcode send_report();
+
+    /**
+     * @brief sends the oldest samples from the backlog to the server in one
+     * http request and removes them from the backlog if that succeeded
+     * 
+     * @retval ok - request was sent
+     * @retval err - couldn't send request because not connected or connection interrupted
+     */
+    el::retcode send_backlog();
+
+    /**
+     * @brief uploads the JSON schema of the settings to the server, so it
+     * knows names, ranges and units of all settings of this firmware
+     * 
+     * @retval ok - request was sent
+     * @retval err - couldn't send request because not connected or connection interrupted
+     */
+    el::retcode send_settings_schema();
+
+    /**
+     * @brief uploads a captured voltage sag to the server using http
+     * 
+     * @param _capture the capture to upload
+     * @retval ok - request was sent
+     * @retval err - couldn't send request because not connected or connection interrupted
+     */
+    el::retcode send_sag_capture(const sag::capture_t &_capture);
 };
 
 
@@ -94,6 +326,10 @@ void net::init()
 {
     wifi_event_group = xEventGroupCreate();
 
+    // continues without backlog if this fails
+    backlog::init();
+    boot_number = backlog::get_boot_number();
+
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -135,26 +371,81 @@ void net::init()
     LOGI("wifi_init_sta finished, starting networking task");
 
     // start the networking task
-    task_handle = xTaskCreateStatic(
+    task_handle = topology::create_task(
+        topology::NETWORKING,
         task_fn,
-        "networking",
-        TASK_STACK_SIZE,
-        nullptr,
-        1,
         task_stack,
+        TASK_STACK_SIZE,
         &task_static_buffer
     );
 }
 
-void net::update()
+void net::update(const report_t &_report)
 {
+    sample_queue.push({
+        .boot = boot_number,
+        .timestamp_ms = esp_timer_get_time() / 1000,
+        .report = _report
+    });
+
     // notify task of the new report
     xEventGroupSetBits(wifi_event_group, REPORT_READY_FOR_SEND_BIT);
 }
 
+void net::flush()
+{
+    xEventGroupSetBits(wifi_event_group, FLUSH_REPORT_BIT);
+}
+
 static void net::task_fn(void *_arg)
 {
     bool network_ready = false;
+    // whether the settings schema was uploaded since the connection came up
+    bool schema_sent = false;
+    // whether the last upload failed although the network is up (e.g. the
+    // server is unreachable), new samples go to the backlog until an
+    // upload from the backlog succeeds
+    bool uploads_failing = false;
+    // earliest time of the next upload from the backlog, and while uploads
+    // are failing of any upload
+    int64_t next_upload_us = 0;
+    // time to wait after the next failed upload
+    int64_t retry_delay_ms = UPLOAD_RETRY_MIN_MS;
+    // time the first sample of the batch being collected was
+    // queued (-1 if no batch is being collected)
+    int64_t batch_start_us = -1;
+    // whether the batch should be uploaded before it is complete
+    bool flush_requested = false;
+
+    // schedules the next upload, with exponential backoff while uploads fail
+    auto upload_done = [&](bool _ok) {
+        int64_t now = esp_timer_get_time();
+        if (_ok)
+        {
+            uploads_failing = false;
+            retry_delay_ms = UPLOAD_RETRY_MIN_MS;
+            next_upload_us = now + BACKLOG_UPLOAD_INTERVAL_MS * 1000LL;
+            return;
+        }
+        LOGW("Upload failed, retrying in %d s", (int)(retry_delay_ms / 1000));
+        uploads_failing = true;
+        next_upload_us = now + retry_delay_ms * 1000LL;
+        retry_delay_ms = MIN(retry_delay_ms * 2, UPLOAD_RETRY_MAX_MS);
+    };
+
+    // time the batch being collected is complete (in the past if it
+    // is already complete), or -1 if no batch is being collected
+    auto batch_due_us = [&]() -> int64_t {
+        if (batch_start_us < 0)
+            return -1;
+        int64_t due_us = batch_start_us + settings::get(settings::REPORT_BATCH_INTERVAL) * 1000LL;
+        if (flush_requested || sample_queue.size() >= (size_t)settings::get(settings::REPORT_BATCH_SIZE))
+            due_us = 0;
+        // failing uploads are retried after the backoff only
+        if (uploads_failing)
+            due_us = MAX(due_us, next_upload_us);
+        return due_us;
+    };
 
     for (;;)
     {
@@ -164,26 +455,59 @@ static void net::task_fn(void *_arg)
          *  - WiFi disconnected
          *  - WiFi should try to reconnect later
          *  - Report is ready to send
+         *  - Report should be sent immediately
+         * or until the server address has to be refreshed, samples
+         * from the backlog can be uploaded or the batch is due
          */
+        int64_t now = esp_timer_get_time();
+        int64_t timeout_us = -1;
+        if (network_ready)
+        {
+            timeout_us = server_address.time_until_refresh(now);
+            if (backlog::size() > 0)
+            {
+                int64_t time_until_upload = MAX(next_upload_us - now, 0);
+                if (timeout_us < 0 || time_until_upload < timeout_us)
+                    timeout_us = time_until_upload;
+            }
+            if (batch_start_us >= 0)
+            {
+                int64_t time_until_batch = MAX(batch_due_us() - now, 0);
+                if (timeout_us < 0 || time_until_batch < timeout_us)
+                    timeout_us = time_until_batch;
+            }
+        }
         EventBits_t bits = xEventGroupWaitBits(
             wifi_event_group,
-            WIFI_CONNECTED_BIT | WIFI_DISCONNECTED_BIT | WIFI_RECONNECT_LATER_BIT | REPORT_READY_FOR_SEND_BIT,
+            WIFI_CONNECTED_BIT | WIFI_DISCONNECTED_BIT | WIFI_RECONNECT_LATER_BIT | REPORT_READY_FOR_SEND_BIT | FLUSH_REPORT_BIT,
             pdTRUE,
             pdFALSE,
-            portMAX_DELAY
+            timeout_us >= 0 ? pdMS_TO_TICKS((timeout_us + 999) / 1000) : portMAX_DELAY
         );
 
+        // a timeout (no bits) only does the background work below
         // WIFI_CONNECTED event tells task that a network connection has been established
         if (bits & WIFI_CONNECTED_BIT)
         {
             LOGI("Network connection up");
             network_ready = true;
+            // we may be in a different network now
+            server_address.invalidate();
+            schema_sent = false;
+            uploads_failing = false;
+            retry_delay_ms = UPLOAD_RETRY_MIN_MS;
+            next_upload_us = 0;
         }
         // WIFI_DISCONNECTED event tells task that network connection has disconnected
         else if (bits & WIFI_DISCONNECTED_BIT)
         {
             LOGI("Network connection down");
             network_ready = false;
+            // the connection is dead, don't try to reuse it
+            reset_http_client();
+            store_samples();
+            batch_start_us = -1;
+            flush_requested = false;
         }
         // WIFI_RECONNECT_LATER event tells task that it should wait a bit and then try to reconnect to the network
         else if (bits & WIFI_RECONNECT_LATER_BIT)
@@ -192,23 +516,82 @@ static void net::task_fn(void *_arg)
             sleep(WIFI_RECONNECT_LONG_PERIOD);
             esp_wifi_connect();
         }
-        // REPORT_READY_FOR_SEND event tells task that a new report is ready to send and it should send it now if possible
-        else if (bits & REPORT_READY_FOR_SEND_BIT)
+        // REPORT_READY_FOR_SEND event tells task that a new report is ready to send and it should send it
+        // when the batch is complete, FLUSH_REPORT tells it to send the batch now
+        else if (bits & (REPORT_READY_FOR_SEND_BIT | FLUSH_REPORT_BIT))
         {
-            if (network_ready)
+            // while uploads are failing, new samples go to the backlog and
+            // uploads are retried from there (or directly if there is no backlog)
+            if (network_ready && (!uploads_failing || backlog::get_stats().capacity == 0))
             {
-                // try to send the report (ignore errors)
-                send_report();
+                // the batch is sent below once it is complete
+                if (batch_start_us < 0)
+                    batch_start_us = esp_timer_get_time();
+                if (bits & FLUSH_REPORT_BIT)
+                    flush_requested = true;
             }
             else
             {
-                LOGI("Cannot send report now because network is down.");
+                LOGI("Cannot send report now, keeping it in the backlog.");
+                store_samples();
             }
         }
-        else
+        else if (bits != 0)
         {
             LOGE("UNEXPECTED NETWORKING EVENT BITS");
         }
+
+        // background work is scheduled by deadlines, so it isn't
+        // starved by a steady stream of reports
+        now = esp_timer_get_time();
+        if (network_ready)
+        {
+            if (server_address.time_until_refresh(now) == 0 && !server_address.refresh(now))
+                LOGW("Couldn't refresh address of %s, using cached address until it expires", SERVER_HOST);
+
+            // drain the backlog one report at a time
+            if (backlog::size() > 0 && now >= next_upload_us)
+                upload_done(send_backlog() == el::retcode::ok);
+        }
+
+        // upload the batch once enough samples were collected, the oldest
+        // one waited long enough or an upload was requested (and not before
+        // the retry time while uploads are failing)
+        int64_t due_us = batch_due_us();
+        if (network_ready && due_us >= 0 && esp_timer_get_time() >= due_us)
+        {
+            batch_start_us = -1;
+            flush_requested = false;
+
+            // the server may have restarted or changed since we were last connected
+            if (!schema_sent)
+                schema_sent = send_settings_schema() == el::retcode::ok;
+
+            // a batch may need more than one report if it doesn't fit into the
+            // report buffer. If sending fails, keep the following samples in the backlog.
+            bool sent;
+            do
+            {
+                sent = send_report() == el::retcode::ok;
+            } while (sent && sample_queue.size() > 0);
+            if (!sent)
+            {
+                store_samples();
+                upload_done(false);
+            }
+            else if (uploads_failing)
+            {
+                upload_done(true);
+            }
+
+            // upload any voltage sags captured since the last report
+            sag::capture_t capture;
+            while (sag::take_capture(capture))
+            {
+                if (send_sag_capture(capture) != el::retcode::ok)
+                    LOGW("Sag capture of cell %d could not be uploaded and was discarded", capture.cell);
+            }
+        }
     }
 
     // should never get here
@@ -270,35 +653,20 @@ esp_err_t net::http_event_handler(
     esp_http_client_event_t *_evt
 )
 {
-    // Stores number of bytes already read (in case of multiple data events)
-    // so the buffer offset can be calculated
-    static size_t output_len;
-
     switch (_evt->event_id)
     {
     case HTTP_EVENT_ON_DATA:
         LOGI("Received response data chunk, len=%d", _evt->data_len);
-        // only read respose if entire response is transmitted at once
-        if (!esp_http_client_is_chunked_response(_evt->client))
+        // the client decodes chunked responses, so the body arrives here
+        // the same way with and without a Content-Length
+        if (http_response_length + _evt->data_len > HTTP_RESPONSE_MAX_LEN)
         {
-            // If user_data buffer is configured, copy the response into the buffer
-            if (_evt->user_data)
-            {
-                if (output_len + _evt->data_len > HTTP_RESPONSE_MAX_LEN)
-                {
-                    LOGE("HTTP response too long for buffer, may be incomplete");
-                    break;
-                }
-                memcpy((char *)_evt->user_data + output_len, _evt->data, _evt->data_len);
-                output_len += _evt->data_len;
-                *((char *)_evt->user_data + output_len) = 0;   // null terminator (may be overwritten by next chunk)
-            }
+            http_response_truncated = true;
+            break;
         }
-        break;
-
-    case HTTP_EVENT_ON_FINISH:
-    case HTTP_EVENT_DISCONNECTED:
-        output_len = 0;
+        memcpy(http_response_buffer + http_response_length, _evt->data, _evt->data_len);
+        http_response_length += _evt->data_len;
+        http_response_buffer[http_response_length] = 0;
         break;
 
     default:
@@ -307,62 +675,354 @@ esp_err_t net::http_event_handler(
     return ESP_OK;
 }
 
-el::retcode net::send_report()
+static void net::reset_http_client()
 {
-    // return value for single-point return
-    el::retcode retval = el::retcode::ok;
-    // response buffer
-    char http_response_buffer[HTTP_RESPONSE_MAX_LEN + 1];
-    // status code
-    int status_code;
-
-    esp_http_client_config_t config = {
-        .url = "http://elektronlab.local:8080/devtools/http/batt1",
-        .method = HTTP_METHOD_POST,
-        .event_handler = http_event_handler,
-        .user_data = http_response_buffer
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (http_client == nullptr)
+        return;
+    esp_http_client_cleanup(http_client);
+    http_client = nullptr;
+}
 
-    nlohmann::json post_data{
-        {"c1_voltage", report.c1_voltage},
-        {"c2_voltage", report.c2_voltage},
-        {"c1_warn_threshold", report.c1_warn_threshold},
-        {"c2_warn_threshold", report.c2_warn_threshold},
-        {"c1_alarm_threshold", report.c1_alarm_threshold},
-        {"c2_alarm_threshold", report.c2_alarm_threshold},
-        {"diff_alarm_threshold", report.diff_alarm_threshold}
-    };
-    const std::string &post_data_str = post_data.dump();
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, post_data_str.c_str(), post_data_str.size());
+static void net::add_latency(latency_stats_t &_stats, int64_t _latency_us)
+{
+    _stats.count++;
+    _stats.total_us += _latency_us;
+    _stats.max_us = MAX(_stats.max_us, _latency_us);
+}
 
-    LOGI("Sending report via HTTP...");
-    esp_err_t err = esp_http_client_perform(client);
+static bool net::resolve_host(const char *_host, uint32_t &_address)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+
+    int err = getaddrinfo(_host, nullptr, &hints, &result);
+    if (err != 0 || result == nullptr)
+    {
+        LOGE("Couldn't resolve %s (%d)", _host, err);
+        return false;
+    }
+
+    _address = ((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(result);
+
+    const uint8_t *bytes = (const uint8_t *)&_address;
+    LOGI("Resolved %s to %d.%d.%d.%d", _host, bytes[0], bytes[1], bytes[2], bytes[3]);
+    return true;
+}
+
+static el::retcode net::post(const char *_path, const char *_content_type, const char *_data, size_t _length)
+{
+    int64_t start_time = esp_timer_get_time();
+    int32_t start_heap = esp_get_free_heap_size();
+    esp_err_t err = ESP_FAIL;
+
+    // connect to the cached address instead of resolving the host name
+    uint32_t address;
+    if (!server_address.lookup(start_time, address))
+        return el::retcode::err;
+    const uint8_t *bytes = (const uint8_t *)&address;
+    char url[URL_MAX_LEN];
+    snprintf(
+        url,
+        sizeof(url),
+        "http://%d.%d.%d.%d:%d" SERVER_PATH "%s",
+        bytes[0], bytes[1], bytes[2], bytes[3],
+        SERVER_PORT,
+        _path
+    );
+
+    // retry once if a reused connection fails
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int64_t attempt_start_time = esp_timer_get_time();
+        bool reused = http_client != nullptr;
+        if (!reused)
+        {
+            esp_http_client_config_t config = {
+                .url = url,
+                .method = HTTP_METHOD_POST,
+                .timeout_ms = HTTP_TIMEOUT_MS,
+                .event_handler = http_event_handler,
+                // detect dead connections while idle between reports
+                .keep_alive_enable = true,
+            };
+            http_client = esp_http_client_init(&config);
+            if (http_client == nullptr)
+            {
+                LOGE("Couldn't create HTTP client");
+                return el::retcode::err;
+            }
+            http_stats.connections++;
+        }
+
+        http_response_buffer[0] = 0;
+        http_response_length = 0;
+        http_response_truncated = false;
+        esp_http_client_set_url(http_client, url);
+        // after set_url(), which resets the header when the address changes
+        esp_http_client_set_header(http_client, "Host", SERVER_HOST_HEADER);
+        esp_http_client_set_method(http_client, HTTP_METHOD_POST);
+        esp_http_client_set_header(http_client, "Content-Type", _content_type);
+        esp_http_client_set_post_field(http_client, _data, _length);
+        err = esp_http_client_perform(http_client);
+        add_latency(
+            reused ? http_stats.reused_connection : http_stats.new_connection,
+            esp_timer_get_time() - attempt_start_time
+        );
+        if (err == ESP_OK)
+            break;
+
+        // the connection is broken, start over with a new one
+        reset_http_client();
+
+        // only repeat requests that can't have reached the server
+        if (!reused || (err != ESP_ERR_HTTP_CONNECT && err != ESP_ERR_HTTP_WRITE_DATA))
+            break;
+        LOGI("Reused HTTP connection failed, reconnecting");
+        http_stats.retries++;
+    }
+
+    http_stats.requests++;
+    http_stats.last_latency_us = esp_timer_get_time() - start_time;
+    http_stats.last_heap_delta = (int32_t)esp_get_free_heap_size() - start_heap;
+    http_stats.max_heap_drop = MAX(http_stats.max_heap_drop, -http_stats.last_heap_delta);
+    LOGI(
+        "POST %s took %lld us, free heap changed by %ld bytes",
+        url,
+        http_stats.last_latency_us,
+        (long)http_stats.last_heap_delta
+    );
 
     if (err != ESP_OK)
     {
-        LOGE("Couldn't send report via HTTP: %s", esp_err_to_name(err));
-        retval = el::retcode::err;
-        goto cleanup;
+        LOGE("Couldn't send HTTP request: %s", esp_err_to_name(err));
+        // the server may have a new address if it can't be reached at all,
+        // a timeout or broken connection doesn't justify resolving again
+        if (err == ESP_ERR_HTTP_CONNECT)
+            server_address.invalidate();
+        return el::retcode::err;
     }
 
-    status_code = esp_http_client_get_status_code(client);
+    int status_code = esp_http_client_get_status_code(http_client);
     if (status_code != 200)
     {
         LOGE("Server responded with non-200 status code %d", status_code);
-        retval = el::retcode::err;
-        goto cleanup;
+        return el::retcode::err;
     }
 
-    LOGI("Server response (%lld bytes):\n%s",
-        esp_http_client_get_content_length(client),
-        http_response_buffer
-    );
+    return el::retcode::ok;
+}
+
+template <typename W, typename S>
+static size_t net::write_report(W &_writer, S &_next_sample)
+{
+    sample_t sample;
+    size_t sample_count = 0;
+
+    _writer.begin_object();
+    _writer.field("format", REPORT_FORMAT_VERSION);
+    _writer.field("uptime_ms", esp_timer_get_time() / 1000);
+    _writer.field("boot", boot_number);
+
+    // as many samples as fit, the rest stays where it is for the next report
+    _writer.key("samples").begin_array();
+    while (_writer.remaining() >= report_reserve(_writer) && _next_sample(sample))
+    {
+        write_sample(_writer, sample);
+        sample_count++;
+    }
+    _writer.end_array();
+    if (sample_count == 0)
+        return 0;
+
+    concurrency::queue_stats_t queue_stats = sample_queue.get_stats();
+    _writer.key("queue").begin_object()
+        .field("pushed", queue_stats.pushed)
+        .field("popped", queue_stats.popped)
+        .field("dropped", queue_stats.dropped)
+        .field("high_water", queue_stats.high_water)
+        .end_object();
+    backlog::stats_t backlog_stats = backlog::get_stats();
+    _writer.key("backlog").begin_object()
+        .field("pending", backlog_stats.pending)
+        .field("stored", backlog_stats.stored)
+        .field("dropped", backlog_stats.dropped)
+        .field("capacity", backlog_stats.capacity)
+        .end_object();
+    _writer.key("http").begin_object()
+        .field("requests", http_stats.requests)
+        .field("resolve_hits", server_address.hits)
+        .field("resolve_misses", server_address.misses)
+        .field("resolve_failures", server_address.failures)
+        .field("connections", http_stats.connections)
+        .field("retries", http_stats.retries)
+        .field("sample_requests", http_stats.sample_requests)
+        .field("samples", http_stats.samples)
+        .field("new_avg_us", http_stats.new_connection.count > 0 ? http_stats.new_connection.total_us / http_stats.new_connection.count : 0)
+        .field("new_max_us", http_stats.new_connection.max_us)
+        .field("reused_avg_us", http_stats.reused_connection.count > 0 ? http_stats.reused_connection.total_us / http_stats.reused_connection.count : 0)
+        .field("reused_max_us", http_stats.reused_connection.max_us)
+        .field("last_latency_us", http_stats.last_latency_us)
+        .field("last_heap_delta", http_stats.last_heap_delta)
+        .field("max_heap_drop", http_stats.max_heap_drop)
+        .field("min_free_heap", esp_get_minimum_free_heap_size())
+        .end_object();
+    _writer.end_object();
+
+    return sample_count;
+}
+
+template <typename S>
+static el::retcode net::send_samples(S &_next_sample)
+{
+    const char *content_type;
+    const char *data;
+    size_t length;
+    size_t sample_count;
+    bool fits;
 
-cleanup:
-    LOGI("Report done, cleaning up");
-    esp_http_client_cleanup(client);
+    if (settings::get(settings::REPORT_ENCODING) == REPORT_CBOR)
+    {
+        cbor_writer writer((uint8_t *)report_buffer, sizeof(report_buffer));
+        sample_count = write_report(writer, _next_sample);
+        content_type = "application/cbor";
+        data = writer.data();
+        length = writer.size();
+        fits = writer.ok();
+    }
+    else
+    {
+        json_writer writer(report_buffer, sizeof(report_buffer));
+        sample_count = write_report(writer, _next_sample);
+        content_type = "application/json";
+        data = writer.data();
+        length = writer.size();
+        fits = writer.ok();
+    }
+
+    if (sample_count == 0)
+        return el::retcode::ok;
+
+    if (!fits)
+    {
+        LOGE("Report doesn't fit into the report buffer, discarding %d samples", (int)sample_count);
+        return el::retcode::err;
+    }
+
+    LOGI("Sending %d samples (%d bytes of %s) via HTTP...", (int)sample_count, (int)length, content_type);
+    if (post("", content_type, data, length) != el::retcode::ok)
+        return el::retcode::err;
+
+    http_stats.sample_requests++;
+    http_stats.samples += sample_count;
+    LOGI("Server response:\n%s", http_response_buffer);
+
+    // the response is the downlink for configuration changes
+    if (http_response_truncated)
+        LOGE("Server response is longer than %d bytes, ignoring the control message", HTTP_RESPONSE_MAX_LEN);
+    else if (control::apply_message(http_response_buffer, http_response_length) != el::retcode::ok)
+        LOGE("Server response is not a valid control message");
+
+    return el::retcode::ok;
+}
+
+el::retcode net::send_report()
+{
+    // keep a copy of the samples taken from the queue
+    size_t count = 0;
+    auto next_sample = [&count](sample_t &_sample) {
+        if (count >= REPORT_MAX_SAMPLES || !sample_queue.pop(_sample))
+            return false;
+        report_samples[count++] = _sample;
+        return true;
+    };
+    if (send_samples(next_sample) == el::retcode::ok)
+        return el::retcode::ok;
+
+    // the samples are older than the ones still queued,
+    // so they go to the backlog first
+    store_samples(report_samples, count);
+    return el::retcode::err;
+}
+
+el::retcode net::send_backlog()
+{
+    backlog::cursor_t cursor = backlog::begin();
+    auto next_sample = [&cursor](sample_t &_sample) {
+        return backlog::read(cursor, _sample);
+    };
+    if (send_samples(next_sample) != el::retcode::ok)
+        return el::retcode::err;
+
+    backlog::consume(cursor);
+    LOGI("%d samples left in the backlog", (int)backlog::size());
+    return el::retcode::ok;
+}
+
+static void net::store_samples()
+{
+    // without backlog, the samples stay in the queue as long as there is space
+    if (backlog::get_stats().capacity == 0)
+        return;
+
+    sample_t sample;
+    size_t count = 0;
+    while (sample_queue.pop(sample))
+    {
+        if (backlog::push(sample) == el::retcode::ok)
+            count++;
+    }
+    if (count > 0)
+        LOGI("Stored %d samples in the backlog (%d pending)", (int)count, (int)backlog::size());
+}
+
+static void net::store_samples(const sample_t *_samples, size_t _count)
+{
+    if (backlog::get_stats().capacity == 0)
+    {
+        if (_count > 0)
+            LOGW("No backlog, %d samples of the failed upload are lost", (int)_count);
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < _count; i++)
+    {
+        if (backlog::push(_samples[i]) == el::retcode::ok)
+            count++;
+    }
+    if (count > 0)
+        LOGI("Stored %d samples of the failed upload in the backlog (%d pending)", (int)count, (int)backlog::size());
+}
+
+concurrency::queue_stats_t net::get_queue_stats()
+{
+    return sample_queue.get_stats();
+}
+
+el::retcode net::send_settings_schema()
+{
+    const std::string &post_data_str = settings::get_json_schema();
+
+    LOGI("Sending settings schema via HTTP...");
+    return post("/settings/schema", "application/schema+json", post_data_str.c_str(), post_data_str.size());
+}
+
+el::retcode net::send_sag_capture(const sag::capture_t &_capture)
+{
+    nlohmann::json post_data{
+        {"cell", _capture.cell},
+        {"trigger_time_us", _capture.trigger_time_us},
+        {"min_voltage", _capture.min_voltage},
+        {"sample_period_us", sag::CAPTURE_SAMPLE_PERIOD_US},
+        {"trigger_index", sag::PRE_TRIGGER_SAMPLES},
+        {"dropped_captures", sag::get_dropped_count()},
+        {"samples", _capture.samples}
+    };
+    const std::string &post_data_str = post_data.dump();
 
-    return retval;
+    LOGI("Sending sag capture of cell %d (min %d mV) via HTTP...", _capture.cell, _capture.min_voltage);
+    return post("/sag", "application/json", post_data_str.c_str(), post_data_str.size());
 }
@@ -0,0 +1,173 @@
+/**
+ * @file sag.cpp
+ * @author melektron
+ * @brief high rate capture of cell voltage sags
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "sag.hpp"
+#include "settings.hpp"
+#include "env.hpp"
+#include "log.hpp"
+
+// maximum number of completed captures waiting to be retrieved
+#define CAPTURE_QUEUE_LENGTH 4
+
+
+namespace sag   // private
+{
+    // statically allocated capture queue
+    static StaticQueue_t queue_static_buffer;
+    static uint8_t queue_storage[CAPTURE_QUEUE_LENGTH * sizeof(capture_t)];
+    static QueueHandle_t queue_handle = nullptr;
+
+    // number of captures that didn't fit into the queue
+    static std::atomic<uint32_t> dropped_count(0);
+
+    // copy of the SAG_TRIGGER_VOLTAGE setting, updated on change
+    static std::atomic<int> trigger_voltage(0);
+
+    // capture state of one cell
+    struct cell_state_t
+    {
+        // decimation accumulator
+        int decimation_sum = 0;
+        int decimation_count = 0;
+
+        // pre-trigger ring buffer
+        uint16_t ring[PRE_TRIGGER_SAMPLES] = { 0 };
+        size_t ring_head = 0;   // index the next sample will be written to
+        size_t ring_fill = 0;   // number of valid samples in the ring
+
+        // whether a new sag may trigger a capture
+        bool armed = true;
+        // whether a capture is currently being recorded
+        bool capturing = false;
+        // number of samples of the capture recorded so far
+        size_t capture_fill = 0;
+        capture_t capture;
+    };
+    static cell_state_t cell_states[env::NR_OF_CELLS];
+
+    /**
+     * @brief processes one decimated sample of a cell
+     * 
+     * @param _cell index of the cell
+     * @param _state state of that cell
+     * @param _voltage decimated voltage in mV
+     * @param _time_us time of the last conversion in the decimated sample
+     */
+    static void process_sample(int _cell, cell_state_t &_state, int _voltage, int64_t _time_us);
+};
+
+
+void sag::init()
+{
+    queue_handle = xQueueCreateStatic(
+        CAPTURE_QUEUE_LENGTH,
+        sizeof(capture_t),
+        queue_storage,
+        &queue_static_buffer
+    );
+
+    settings::subscribe(
+        settings::make_mask({settings::SAG_TRIGGER_VOLTAGE}),
+        [](const settings::key_mask_t &) {
+            trigger_voltage = settings::get(settings::SAG_TRIGGER_VOLTAGE);
+        }
+    );
+    trigger_voltage = settings::get(settings::SAG_TRIGGER_VOLTAGE);
+}
+
+void sag::feed(int _cell, int _voltage, int64_t _time_us)
+{
+    if (_cell < 0 || _cell >= (int)env::NR_OF_CELLS)
+        return;
+    cell_state_t &state = cell_states[_cell];
+
+    state.decimation_sum += _voltage;
+    state.decimation_count++;
+    if (state.decimation_count < DECIMATION_FACTOR)
+        return;
+
+    int voltage = state.decimation_sum / state.decimation_count;
+    state.decimation_sum = 0;
+    state.decimation_count = 0;
+
+    process_sample(_cell, state, voltage, _time_us);
+}
+
+bool sag::take_capture(capture_t &_capture)
+{
+    if (queue_handle == nullptr)
+        return false;
+    return xQueueReceive(queue_handle, &_capture, 0) == pdTRUE;
+}
+
+uint32_t sag::get_dropped_count()
+{
+    return dropped_count.load(std::memory_order_relaxed);
+}
+
+static void sag::process_sample(int _cell, cell_state_t &_state, int _voltage, int64_t _time_us)
+{
+    int threshold = trigger_voltage.load(std::memory_order_relaxed);
+
+    if (_state.capturing)
+    {
+        _state.capture.samples[_state.capture_fill++] = _voltage;
+        if (_voltage < _state.capture.min_voltage)
+            _state.capture.min_voltage = _voltage;
+
+        if (_state.capture_fill == CAPTURE_SAMPLES)
+        {
+            _state.capturing = false;
+            if (queue_handle == nullptr || xQueueSend(queue_handle, &_state.capture, 0) != pdTRUE)
+                dropped_count++;
+        }
+        return;
+    }
+
+    if (!_state.armed)
+    {
+        // re-arm once the cell has recovered from the last sag
+        if (_voltage >= threshold)
+            _state.armed = true;
+    }
+    else if (_voltage < threshold && _state.ring_fill == PRE_TRIGGER_SAMPLES)
+    {
+        // freeze the pre-trigger history (oldest sample first) into the capture
+        // and continue recording the post-trigger samples
+        _state.armed = false;
+        _state.capturing = true;
+        _state.capture.cell = _cell;
+        _state.capture.trigger_time_us = _time_us;
+        _state.capture.min_voltage = _voltage;
+        for (size_t i = 0; i < PRE_TRIGGER_SAMPLES; i++)
+        {
+            uint16_t sample = _state.ring[(_state.ring_head + i) % PRE_TRIGGER_SAMPLES];
+            _state.capture.samples[i] = sample;
+            if (sample < _state.capture.min_voltage)
+                _state.capture.min_voltage = sample;
+        }
+        _state.capture_fill = PRE_TRIGGER_SAMPLES;
+        _state.capture.samples[_state.capture_fill++] = _voltage;
+        // the ring starts over after a capture so the next one
+        // gets a full, fresh history again
+        _state.ring_fill = 0;
+        return;
+    }
+
+    _state.ring[_state.ring_head] = _voltage;
+    _state.ring_head = (_state.ring_head + 1) % PRE_TRIGGER_SAMPLES;
+    if (_state.ring_fill < PRE_TRIGGER_SAMPLES)
+        _state.ring_fill++;
+}
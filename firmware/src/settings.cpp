@@ -10,10 +10,23 @@
  */
 
 #include <inttypes.h>
+#include <atomic>
+#include <array>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_rom_crc.h>
 #include <nvs_flash.h>
 #include <nvs.h>
+#include <nlohmann/json.hpp>
 
 #include "settings.hpp"
+#include "seqlock.hpp"
+#include "soc.hpp"
+#include "report_encoding.hpp"
+#include "topology.hpp"
+#include "utils.hpp"
 #include "log.hpp"
 
 namespace settings // private
@@ -21,30 +34,403 @@ namespace settings // private
 
 #define NR_OF_SETTINGS __SETTING_END
 
-    // an array of all the settings names 
-    // (according to the order in the key_t enum)
-    static const char *setting_names[NR_OF_SETTINGS] = {
-        "c1_warn_v",
-        "c2_warn_v",
-        "c1_alarm_v",
-        "c2_alarm_v",
-        "c_alarm_diff_v",
+#define NR_OF_GLOBAL_SETTINGS (NR_OF_SETTINGS - NR_OF_PER_CELL_SETTINGS * env::NR_OF_CELLS)
+
+    // how a setting value is interpreted
+    enum type_t
+    {
+        INTEGER,        // any number between min and max
+        ENUMERATION,    // one of the enum values between min and max
+    };
+
+    /**
+     * @brief describes one setting, or one per cell setting for all cells
+     */
+    struct schema_entry_t
+    {
+        // key of the setting (of the first cell for per cell settings)
+        key_t key;
+        // NVS key name, a '#' marks a per cell setting and
+        // is replaced with the cell number (starting at 1)
+        const char *name;
+        type_t type;
+        int32_t default_value;
+        // valid range (inclusive)
+        int32_t min;
+        int32_t max;
+        const char *unit;
+    };
+
+    // all settings (in key_t order), everything else is generated from this
+    constexpr schema_entry_t SCHEMA[] = {
+        // key                              name                type         default  min    max      unit
+        {CELL_WARN_VOLTAGE,                 "c#_warn_v",        INTEGER,     3000,    0,     5000,    "mV"},
+        {CELL_ALARM_VOLTAGE,                "c#_alarm_v",       INTEGER,     2800,    0,     5000,    "mV"},
+        {CELL_VOLTAGE_CORRECTION,           "c#_v_corr",        INTEGER,     10000,   5000,  15000,   "1/10000"},
+        {CELL_ALARM_VOLTAGE_DIFFERENCE,     "c_alarm_diff_v",   INTEGER,     1000,    0,     5000,    "mV"},
+        {SAMPLING_CONFIDENCE_BOUND,         "smpl_conf_mv",     INTEGER,     5,       1,     1000,    "mV"},
+        {SAMPLING_MIN_SAMPLES,              "smpl_min",         INTEGER,     16,      1,     65535,   "samples"},
+        {SAMPLING_MAX_SAMPLES,              "smpl_max",         INTEGER,     1024,    1,     65535,   "samples"},
+        {SAG_TRIGGER_VOLTAGE,               "sag_trig_v",       INTEGER,     3000,    0,     5000,    "mV"},
+        {FILTER_TIME_CONSTANT,              "filter_tau_ms",    INTEGER,     1000,    0,     3600000, "ms"},
+        {BATTERY_CHEMISTRY,                 "bat_chem",         ENUMERATION, 0,       0,     battery::soc::__CHEMISTRY_END - 1, ""},
+        {MONITOR_MIN_INTERVAL,              "mon_min_ms",       INTEGER,     1000,    100,   3600000, "ms"},
+        {MONITOR_MAX_INTERVAL,              "mon_max_ms",       INTEGER,     20000,   100,   3600000, "ms"},
+        {MONITOR_SLOW_MARGIN,               "mon_margin_mv",    INTEGER,     300,     1,     5000,    "mV"},
+        {ALARM_HYSTERESIS,                  "alarm_hyst_mv",    INTEGER,     50,      0,     1000,    "mV"},
+        {ALARM_DEBOUNCE,                    "alarm_debounce",   INTEGER,     2,       1,     255,     "cycles"},
+        {REPORT_ENCODING,                   "rep_enc",          ENUMERATION, 0,       0,     net::__REPORT_ENCODING_END - 1, ""},
+        {REPORT_BATCH_SIZE,                 "rep_batch_n",      INTEGER,     6,       1,     32,      "samples"},
+        {REPORT_BATCH_INTERVAL,             "rep_batch_ms",     INTEGER,     60000,   0,     3600000, "ms"},
     };
 
-    // default values for all the settings (in order)
-    static int32_t setting_defaults[NR_OF_SETTINGS] = {
-        3000,
-        3000,
-        2800,
-        2800,
-        1000
+    /**
+     * @brief a single setting, generated from its schema entry
+     */
+    struct setting_info_t
+    {
+        char name[NVS_KEY_NAME_MAX_SIZE];
+        type_t type;
+        int32_t default_value;
+        int32_t min;
+        int32_t max;
+        const char *unit;
     };
 
-    // cache of setting values stored in RAM (in order)
-    static int32_t setting_read_cache[NR_OF_SETTINGS] = { 0 };
+    /**
+     * @param _name a schema name
+     * @return true if _name contains the cell number placeholder
+     */
+    constexpr bool is_per_cell(const char *_name)
+    {
+        for (; *_name != 0; _name++)
+            if (*_name == '#')
+                return true;
+        return false;
+    }
+
+    /**
+     * @return size_t number of characters of the name of a setting for
+     * the cell _cell_nr (excluding terminator)
+     */
+    constexpr size_t name_length(const char *_name, size_t _cell_nr)
+    {
+        size_t length = 0;
+        for (; *_name != 0; _name++)
+        {
+            if (*_name != '#')
+            {
+                length++;
+                continue;
+            }
+            size_t nr = _cell_nr;
+            do
+            {
+                length++;
+                nr /= 10;
+            } while (nr > 0);
+        }
+        return length;
+    }
+
+    /**
+     * @brief writes the name of a setting for the cell _cell_nr to _out
+     * (must have space for name_length() + 1 characters)
+     */
+    constexpr void format_name(char *_out, const char *_name, size_t _cell_nr)
+    {
+        for (; *_name != 0; _name++)
+        {
+            if (*_name != '#')
+            {
+                *_out++ = *_name;
+                continue;
+            }
+            char digits[20] = {};
+            size_t count = 0;
+            size_t nr = _cell_nr;
+            do
+            {
+                digits[count++] = '0' + nr % 10;
+                nr /= 10;
+            } while (nr > 0);
+            while (count > 0)
+                *_out++ = digits[--count];
+        }
+        *_out = 0;
+    }
+
+    /**
+     * @return true if the schema lists every key exactly once in order,
+     * all names fit into NVS keys and all defaults are in range
+     */
+    constexpr bool schema_valid()
+    {
+        size_t key = 0;
+        size_t per_cell_count = 0;
+        for (const schema_entry_t &entry : SCHEMA)
+        {
+            if (entry.key != key)
+                return false;
+            if (entry.min > entry.default_value || entry.default_value > entry.max)
+                return false;
+            if (name_length(entry.name, env::NR_OF_CELLS) >= NVS_KEY_NAME_MAX_SIZE)
+                return false;
+            
+            if (is_per_cell(entry.name))
+            {
+                // per cell settings have to come first
+                if (per_cell_count * env::NR_OF_CELLS != key)
+                    return false;
+                per_cell_count++;
+                key += env::NR_OF_CELLS;
+            }
+            else
+            {
+                key++;
+            }
+        }
+        return key == NR_OF_SETTINGS && per_cell_count == NR_OF_PER_CELL_SETTINGS;
+    }
+    static_assert(schema_valid(), "settings schema doesn't match key_t");
+
+    /**
+     * @return std::array<setting_info_t, NR_OF_SETTINGS> information
+     * about every setting (in key_t order), expanded from the schema
+     */
+    constexpr std::array<setting_info_t, NR_OF_SETTINGS> generate_setting_table()
+    {
+        std::array<setting_info_t, NR_OF_SETTINGS> table{};
+        for (const schema_entry_t &entry : SCHEMA)
+        {
+            size_t count = is_per_cell(entry.name) ? env::NR_OF_CELLS : 1;
+            for (size_t cell = 0; cell < count; cell++)
+            {
+                setting_info_t &info = table[entry.key + cell];
+                format_name(info.name, entry.name, cell + 1);
+                info.type = entry.type;
+                info.default_value = entry.default_value;
+                info.min = entry.min;
+                info.max = entry.max;
+                info.unit = entry.unit;
+            }
+        }
+        return table;
+    }
+
+    // names, defaults and ranges of all settings (in key_t order)
+    constexpr std::array<setting_info_t, NR_OF_SETTINGS> SETTING_TABLE = generate_setting_table();
+
+    /**
+     * @brief two settings where the lower one must not be greater than
+     * the upper one. Rules of per cell settings apply to every cell.
+     */
+    struct order_rule_t
+    {
+        key_t lower;
+        key_t upper;
+    };
+
+    constexpr order_rule_t ORDER_RULES[] = {
+        // lower                    upper
+        {CELL_ALARM_VOLTAGE,        CELL_WARN_VOLTAGE},
+        {SAMPLING_MIN_SAMPLES,      SAMPLING_MAX_SAMPLES},
+        {MONITOR_MIN_INTERVAL,      MONITOR_MAX_INTERVAL},
+    };
+
+    /**
+     * @return size_t number of cells a rule applies to (1 for global settings)
+     */
+    constexpr size_t rule_cells(const order_rule_t &_rule)
+    {
+        return _rule.lower < NR_OF_PER_CELL_SETTINGS * env::NR_OF_CELLS ? env::NR_OF_CELLS : 1;
+    }
+
+    /**
+     * @return true if the defaults satisfy all order rules
+     */
+    constexpr bool defaults_ordered()
+    {
+        for (const order_rule_t &rule : ORDER_RULES)
+            for (size_t cell = 0; cell < rule_cells(rule); cell++)
+                if (SETTING_TABLE[cell_key(rule.lower, cell)].default_value > SETTING_TABLE[cell_key(rule.upper, cell)].default_value)
+                    return false;
+        return true;
+    }
+    static_assert(defaults_ordered(), "setting defaults violate an order rule");
+
+    /**
+     * @brief searches for a pair of settings violating an order rule
+     *
+     * @param _values the values to check
+     * @param _lower set to the lower setting of the violated rule
+     * @param _upper set to the upper setting of the violated rule
+     * @return true all order rules are satisfied
+     * @return false a rule is violated
+     */
+    static bool check_order(const snapshot_t &_values, key_t &_lower, key_t &_upper);
+
+    // cache of setting values stored in RAM (in order). Transactions 
+    // replace it as a whole, so readers never see half of a transaction.
+    static concurrency::seqlock<snapshot_t> setting_read_cache;
+
+    // serializes writers, as the read cache only supports a single writer
+    static StaticSemaphore_t write_mutex_buffer;
+    static SemaphoreHandle_t write_mutex;
+
+    // maximum number of change subscriptions
+#define MAX_SUBSCRIBERS 8
+
+    /**
+     * @brief a task or callback interested in changes of some settings
+     */
+    struct subscriber_t
+    {
+        key_mask_t keys;
+        TaskHandle_t task;              // task to notify or nullptr
+        change_callback_t callback;     // callback to run or nullptr
+    };
+
+    // subscribers can only be added (under the write mutex), so entries
+    // below nr_of_subscribers never change
+    static subscriber_t subscribers[MAX_SUBSCRIBERS];
+    static std::atomic<size_t> nr_of_subscribers(0);
+
+    // changes not yet handled by the callbacks (protected by the write mutex)
+    static key_mask_t pending_changes;
+
+    // the statically allocated memory for the settings task's stack
+#define TASK_STACK_SIZE 3000
+    static StackType_t task_stack[TASK_STACK_SIZE];
+
+    // handle to stack buffer and handle to task
+    static StaticTask_t task_static_buffer;
+    static TaskHandle_t task_handle = nullptr;
+
+    /**
+     * @brief entry point of the settings task which runs the
+     * change callbacks
+     */
+    static void task_fn(void *);
+
+    /**
+     * @brief adds a subscriber to the list
+     */
+    static void add_subscriber(const subscriber_t &_subscriber);
+
+    /**
+     * @brief notifies all task subscribers interested in the changed
+     * settings and wakes up the settings task for the callbacks
+     *
+     * @param _changed the settings that changed
+     */
+    static void notify_subscribers(const key_mask_t &_changed);
 
     // handle for settings NVS namespace
     static nvs_handle_t settings_handle;
+
+    // NVS key of the blob containing all settings
+#define BLOB_KEY "all"
+    // layout version of the blob, increment and add a migration to
+    // migrate_blob() when the meaning of stored values changes
+#define BLOB_VERSION 1
+    // maximum number of settings that fit in the blob, also
+    // allows loading blobs of newer firmware with more settings
+#define BLOB_MAX_SETTINGS 128
+    static_assert(NR_OF_SETTINGS <= BLOB_MAX_SETTINGS, "too many settings to fit in the settings blob");
+
+    /**
+     * @brief all settings as stored in NVS. Only the used part of
+     * values is stored. Each per cell setting occupies nr_of_cells
+     * values, followed by the global settings, so settings added at the
+     * end of the per cell or global settings and a changed number
+     * of cells can be migrated.
+     */
+    struct blob_t
+    {
+        uint16_t version;
+        uint8_t nr_of_cells;
+        uint8_t nr_of_per_cell_settings;
+        uint16_t nr_of_global_settings;
+        uint16_t reserved;
+        // CRC32 of the used part of the blob (calculated with crc = 0)
+        uint32_t crc;
+        int32_t values[BLOB_MAX_SETTINGS];
+    };
+#define BLOB_HEADER_SIZE offsetof(blob_t, values)
+
+    // buffer for reading and writing the blob (too large for the stack)
+    static blob_t blob;
+
+    enum blob_state_t
+    {
+        BLOB_CURRENT,   // blob loaded, layout is up to date
+        BLOB_MIGRATED,  // blob loaded, layout has to be updated
+        BLOB_MISSING,   // no blob stored
+        BLOB_INVALID,   // blob corrupted
+        BLOB_UNKNOWN,   // blob valid, but of an unknown (newer) version
+    };
+
+    // set when the stored blob is from a newer firmware. It is kept
+    // untouched (so downgrading and upgrading again doesn't lose the
+    // settings) and the settings only live in RAM.
+    static bool keep_stored_blob = false;
+
+    /**
+     * @brief sets all values to their defaults
+     */
+    static void set_defaults(snapshot_t &_values);
+
+    /**
+     * @brief calculates the CRC of the used part of the blob buffer
+     *
+     * @param _size used size of the blob
+     * @return uint32_t the CRC
+     */
+    static uint32_t calculate_blob_crc(size_t _size);
+
+    /**
+     * @brief loads all settings from the blob with a single NVS read.
+     * Settings missing in the blob are set to their default value.
+     *
+     * @param _values where to put the loaded settings
+     * @return blob_state_t whether the blob was loaded
+     */
+    static blob_state_t load_blob(snapshot_t &_values);
+
+    /**
+     * @brief converts the values of a valid blob of the given version
+     * and layout to the current settings
+     *
+     * @param _values where to put the converted settings (pre filled with defaults)
+     * @return true the blob has a known version
+     * @return false the blob version is unknown
+     */
+    static bool migrate_blob(snapshot_t &_values);
+
+    /**
+     * @brief loads settings stored in individual NVS keys by firmware
+     * versions before the blob was introduced
+     *
+     * @param _values where to put the loaded settings (pre filled with defaults)
+     * @return true if any legacy key was found
+     */
+    static bool load_legacy_keys(snapshot_t &_values);
+
+    /**
+     * @brief erases the individual NVS keys of older firmware versions
+     * (and commits if there were any). May only be called once the blob
+     * holding their values is committed, so a reset in between can't
+     * lose the settings.
+     */
+    static void erase_legacy_keys();
+
+    /**
+     * @brief writes all settings to the blob in NVS (without commit)
+     *
+     * @param _values the settings to store
+     */
+    static void store_blob(const snapshot_t &_values);
 };
 
 void settings::init()
@@ -67,48 +453,244 @@ void settings::init()
     // Open the NVS namespace used for settings
     ESP_ERROR_CHECK(nvs_open("settings", NVS_READWRITE, &settings_handle));
 
-    // Prepare all the setting keys
-    bool changes = false;
+    write_mutex = xSemaphoreCreateMutexStatic(&write_mutex_buffer);
+
+    // load all settings at once
+    snapshot_t values;
+    bool changes = true;
+    blob_state_t state = load_blob(values);
+    switch (state)
+    {
+    case BLOB_CURRENT:
+        LOGI("Loaded %d settings", (int)NR_OF_SETTINGS);
+        changes = false;
+        break;
+
+    case BLOB_MIGRATED:
+        LOGI("Migrated settings from older layout");
+        break;
+
+    case BLOB_UNKNOWN:
+        LOGW("Using defaults, the stored settings are kept for the firmware that wrote them");
+        keep_stored_blob = true;
+        changes = false;
+        break;
+
+    case BLOB_MISSING:
+    case BLOB_INVALID:
+        // (re)initialize from the legacy keys if there are any,
+        // otherwise from the defaults
+        if (load_legacy_keys(values))
+            LOGI("Migrated settings from individual keys");
+        else
+            LOGI("No stored settings found, initializing to defaults");
+        break;
+    }
+
+    for (size_t setting_index = 0; setting_index < NR_OF_SETTINGS; setting_index++)
+    {
+        const setting_info_t &info = SETTING_TABLE[setting_index];
+
+        // values stored by older firmware may violate the current ranges
+        if (!validate((key_t)setting_index, values.values[setting_index]))
+        {
+            LOGE(
+                "Stored setting out of range, resetting to default: %s=%" PRIi32,
+                info.name,
+                values.values[setting_index]
+            );
+            values.values[setting_index] = info.default_value;
+            changes = true;
+        }
+
+        LOGI(
+            "Setting: %s=%" PRIi32 " %s",
+            info.name,
+            values.values[setting_index],
+            info.unit
+        );
+    }
+
+    // each value may be in range while a pair of them is not,
+    // reset both settings of such a pair
+    key_t lower, upper;
+    while (!check_order(values, lower, upper))
+    {
+        LOGE(
+            "Stored settings inconsistent, resetting to defaults: %s=%" PRIi32 " > %s=%" PRIi32,
+            SETTING_TABLE[lower].name,
+            values.values[lower],
+            SETTING_TABLE[upper].name,
+            values.values[upper]
+        );
+        values.values[lower] = SETTING_TABLE[lower].default_value;
+        values.values[upper] = SETTING_TABLE[upper].default_value;
+        changes = true;
+    }
+
+    // if anything was migrated or reset, write the changes back
+    if (changes && !keep_stored_blob)
+    {
+        store_blob(values);
+        ESP_ERROR_CHECK(nvs_commit(settings_handle));
+    }
+
+    // the migrated keys are only erased now that the blob is committed
+    // (also the ones left over by a reset during an earlier migration)
+    if (!keep_stored_blob)
+        erase_legacy_keys();
+
+    // publish values to the read cache
+    setting_read_cache.store(values);
+
+    // start the settings task
+    task_handle = topology::create_task(
+        topology::SETTINGS,
+        task_fn,
+        task_stack,
+        TASK_STACK_SIZE,
+        &task_static_buffer
+    );
+}
+
+std::string settings::get_json_schema()
+{
+    nlohmann::json properties = nlohmann::json::object();
+    for (const setting_info_t &info : SETTING_TABLE)
+    {
+        nlohmann::json property{
+            {"type", "integer"},
+            {"default", info.default_value},
+            {"minimum", info.min},
+            {"maximum", info.max}
+        };
+        if (info.type == ENUMERATION)
+        {
+            nlohmann::json values = nlohmann::json::array();
+            for (int32_t value = info.min; value <= info.max; value++)
+                values.push_back(value);
+            property["enum"] = values;
+        }
+        if (info.unit[0] != 0)
+            property["unit"] = info.unit;
+        properties[info.name] = property;
+    }
+
+    nlohmann::json schema{
+        {"$schema", "https://json-schema.org/draft/2020-12/schema"},
+        {"type", "object"},
+        {"properties", properties},
+        {"additionalProperties", false}
+    };
+    return schema.dump();
+}
+
+static void settings::set_defaults(snapshot_t &_values)
+{
     for (size_t setting_index = 0; setting_index < NR_OF_SETTINGS; setting_index++)
+        _values.values[setting_index] = SETTING_TABLE[setting_index].default_value;
+}
+
+static uint32_t settings::calculate_blob_crc(size_t _size)
+{
+    uint32_t stored_crc = blob.crc;
+    blob.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&blob, _size);
+    blob.crc = stored_crc;
+    return crc;
+}
+
+static settings::blob_state_t settings::load_blob(snapshot_t &_values)
+{
+    set_defaults(_values);
+
+    size_t size = sizeof(blob);
+    esp_err_t err = nvs_get_blob(settings_handle, BLOB_KEY, &blob, &size);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return BLOB_MISSING;
+    if (err == ESP_ERR_NVS_INVALID_LENGTH)
+    {
+        LOGE("Settings blob is too large, ignoring it");
+        return BLOB_INVALID;
+    }
+    ESP_ERROR_CHECK(err);
+
+    // check that the header and the stored values are complete
+    size_t nr_of_values = 0;
+    if (size >= BLOB_HEADER_SIZE)
+        nr_of_values = blob.nr_of_per_cell_settings * blob.nr_of_cells + blob.nr_of_global_settings;
+    if (size < BLOB_HEADER_SIZE || nr_of_values > BLOB_MAX_SETTINGS || size != BLOB_HEADER_SIZE + nr_of_values * sizeof(int32_t))
+    {
+        LOGE("Settings blob has invalid size, ignoring it");
+        return BLOB_INVALID;
+    }
+    if (calculate_blob_crc(size) != blob.crc)
+    {
+        LOGE("Settings blob CRC mismatch, ignoring it");
+        return BLOB_INVALID;
+    }
+
+    if (!migrate_blob(_values))
+    {
+        LOGW("Settings blob has unknown version %d", (int)blob.version);
+        set_defaults(_values);
+        return BLOB_UNKNOWN;
+    }
+
+    if (
+        blob.version != BLOB_VERSION ||
+        blob.nr_of_cells != env::NR_OF_CELLS ||
+        blob.nr_of_per_cell_settings != NR_OF_PER_CELL_SETTINGS ||
+        blob.nr_of_global_settings != NR_OF_GLOBAL_SETTINGS
+    )
+        return BLOB_MIGRATED;
+    
+    return BLOB_CURRENT;
+}
+
+static bool settings::migrate_blob(snapshot_t &_values)
+{
+    switch (blob.version)
     {
-        // load the default value in case it needs to be set up
-        int32_t setting_value = setting_defaults[setting_index];
+    case 1:
+        // per cell settings of cells that exist in both layouts
+        for (size_t setting = 0; setting < MIN(blob.nr_of_per_cell_settings, NR_OF_PER_CELL_SETTINGS); setting++)
+        {
+            for (size_t cell = 0; cell < MIN(blob.nr_of_cells, env::NR_OF_CELLS); cell++)
+                _values.values[setting * env::NR_OF_CELLS + cell] = blob.values[setting * blob.nr_of_cells + cell];
+        }
+        // global settings that exist in both layouts
+        for (size_t setting = 0; setting < MIN(blob.nr_of_global_settings, NR_OF_GLOBAL_SETTINGS); setting++)
+        {
+            _values.values[NR_OF_PER_CELL_SETTINGS * env::NR_OF_CELLS + setting] =
+                blob.values[blob.nr_of_per_cell_settings * blob.nr_of_cells + setting];
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
 
-        // try to load the stored value from NVS
-        err = nvs_get_i32(
+static bool settings::load_legacy_keys(snapshot_t &_values)
+{
+    bool found = false;
+    for (size_t setting_index = 0; setting_index < NR_OF_SETTINGS; setting_index++)
+    {
+        esp_err_t err = nvs_get_i32(
             settings_handle,
-            setting_names[setting_index],
-            &setting_value
+            SETTING_TABLE[setting_index].name,
+            &_values.values[setting_index]
         );
 
         switch (err)
         {
         case ESP_OK:
-            // Setting found in NVS
-
-            LOGI(
-                "Successfully read setting: %s=%" PRIi32,
-                setting_names[setting_index],
-                setting_value
-            );
+            found = true;
             break;
 
         case ESP_ERR_NVS_NOT_FOUND:
-            // Setting not found in NVS
-
-            // initialize with default value
-            ESP_ERROR_CHECK(nvs_set_i32(
-                settings_handle,
-                setting_names[setting_index],
-                setting_value
-            ));
-            changes = true;
-
-            LOGI(
-                "Setting not found, initializing to default: %s=%" PRIi32,
-                setting_names[setting_index],
-                setting_value
-            );
+            // keep the default value
             break;
 
         default:
@@ -116,42 +698,274 @@ void settings::init()
             ESP_ERROR_CHECK(err);
             break;
         }
-
-        // store value in read cache
-        setting_read_cache[setting_index] = setting_value;
     }
+    return found;
+}
 
-    // if anything was written to NVS, commit the changes
-    if (changes)
+static void settings::erase_legacy_keys()
+{
+    bool erased = false;
+    for (const setting_info_t &info : SETTING_TABLE)
+    {
+        esp_err_t err = nvs_erase_key(settings_handle, info.name);
+        if (err == ESP_ERR_NVS_NOT_FOUND)
+            continue;
+        ESP_ERROR_CHECK(err);
+        erased = true;
+    }
+    if (erased)
+    {
+        LOGI("Erased the settings keys of older firmware");
         ESP_ERROR_CHECK(nvs_commit(settings_handle));
+    }
+}
+
+static void settings::store_blob(const snapshot_t &_values)
+{
+    size_t size = BLOB_HEADER_SIZE + NR_OF_SETTINGS * sizeof(int32_t);
+    blob.version = BLOB_VERSION;
+    blob.nr_of_cells = env::NR_OF_CELLS;
+    blob.nr_of_per_cell_settings = NR_OF_PER_CELL_SETTINGS;
+    blob.nr_of_global_settings = NR_OF_GLOBAL_SETTINGS;
+    blob.reserved = 0;
+    memcpy(blob.values, _values.values, sizeof(_values.values));
+    blob.crc = calculate_blob_crc(size);
+
+    ESP_ERROR_CHECK(nvs_set_blob(settings_handle, BLOB_KEY, &blob, size));
+}
+
+settings::key_mask_t settings::make_mask(std::initializer_list<key_t> _keys)
+{
+    key_mask_t mask;
+    for (key_t key : _keys)
+        mask.set(key);
+    return mask;
+}
 
+settings::key_mask_t settings::make_cell_mask(key_t _setting)
+{
+    key_mask_t mask;
+    for (size_t cell = 0; cell < env::NR_OF_CELLS; cell++)
+        mask.set(cell_key(_setting, cell));
+    return mask;
 }
 
 int32_t settings::get(key_t _key)
 {
-    return setting_read_cache[_key];
+    // only read the one word instead of copying the whole snapshot
+    return setting_read_cache.load_field<int32_t>(offsetof(snapshot_t, values) + _key * sizeof(int32_t));
 }
 
-void settings::set(key_t _key, int32_t _value)
+settings::snapshot_t settings::get_all()
 {
-    // if there is no change, we don't want to
-    // unnecessarily write to the flash
-    if (_value == setting_read_cache[_key]) return;
+    return setting_read_cache.load();
+}
 
-    // write the new value to flash
-    ESP_ERROR_CHECK(nvs_set_i32(
-        settings_handle,
-        setting_names[_key],
-        _value
-    ));
-    ESP_ERROR_CHECK(nvs_commit(settings_handle));
+void settings::subscribe(const key_mask_t &_keys, TaskHandle_t _task)
+{
+    add_subscriber({
+        .keys = _keys,
+        .task = _task,
+        .callback = nullptr
+    });
+}
 
-    // update the read cache
-    setting_read_cache[_key] = _value;
+void settings::subscribe(const key_mask_t &_keys, change_callback_t _callback)
+{
+    add_subscriber({
+        .keys = _keys,
+        .task = nullptr,
+        .callback = _callback
+    });
+}
 
-    LOGI(
-        "Setting changed: %s=%" PRIi32,
-        setting_names[_key],
-        _value
-    );
+const char *settings::get_name(key_t _key)
+{
+    return SETTING_TABLE[_key].name;
+}
+
+bool settings::find_key(const char *_name, key_t &_key)
+{
+    for (size_t setting_index = 0; setting_index < NR_OF_SETTINGS; setting_index++)
+    {
+        if (strcmp(SETTING_TABLE[setting_index].name, _name) == 0)
+        {
+            _key = (key_t)setting_index;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool settings::validate(key_t _key, int32_t _value)
+{
+    if (_key < 0 || _key >= NR_OF_SETTINGS)
+        return false;
+    const setting_info_t &info = SETTING_TABLE[_key];
+    return _value >= info.min && _value <= info.max;
+}
+
+static bool settings::check_order(const snapshot_t &_values, key_t &_lower, key_t &_upper)
+{
+    for (const order_rule_t &rule : ORDER_RULES)
+    {
+        for (size_t cell = 0; cell < rule_cells(rule); cell++)
+        {
+            _lower = cell_key(rule.lower, cell);
+            _upper = cell_key(rule.upper, cell);
+            if (_values[_lower] > _values[_upper])
+                return false;
+        }
+    }
+    return true;
+}
+
+bool settings::set(key_t _key, int32_t _value)
+{
+    transaction t;
+    if (!t.set(_key, _value))
+        return false;
+    return t.commit();
+}
+
+bool settings::transaction::set(key_t _key, int32_t _value)
+{
+    if (!validate(_key, _value))
+    {
+        LOGE("Rejected invalid value for setting %d: %" PRIi32, (int)_key, _value);
+        return false;
+    }
+
+    staged_values[_key] = _value;
+    staged.set(_key);
+    return true;
+}
+
+bool settings::transaction::commit(size_t *_changes)
+{
+    size_t changes = 0;
+    key_mask_t changed;
+
+    if (_changes != nullptr)
+        *_changes = 0;
+
+    xSemaphoreTake(write_mutex, portMAX_DELAY);
+
+    snapshot_t values = setting_read_cache.load();
+    for (size_t key = 0; key < NR_OF_SETTINGS; key++)
+    {
+        // if there is no change, we don't want to
+        // unnecessarily write to the flash
+        if (!staged.test(key) || staged_values[key] == values.values[key])
+            continue;
+
+        values.values[key] = staged_values[key];
+        changed.set(key);
+        changes++;
+
+        LOGI(
+            "Setting changed: %s=%" PRIi32,
+            SETTING_TABLE[key].name,
+            staged_values[key]
+        );
+    }
+
+    // the staged values have to be consistent with each other
+    // and with the settings that are not part of the transaction
+    key_t lower, upper;
+    if (changes > 0 && !check_order(values, lower, upper))
+    {
+        xSemaphoreGive(write_mutex);
+        LOGE(
+            "Rejected inconsistent settings: %s=%" PRIi32 " > %s=%" PRIi32,
+            SETTING_TABLE[lower].name,
+            values.values[lower],
+            SETTING_TABLE[upper].name,
+            values.values[upper]
+        );
+        staged.reset();
+        return false;
+    }
+
+    if (changes > 0)
+    {
+        // write all new values to flash at once
+        if (keep_stored_blob)
+        {
+            LOGW("Settings blob of newer firmware is kept, changes are not stored");
+        }
+        else
+        {
+            store_blob(values);
+            ESP_ERROR_CHECK(nvs_commit(settings_handle));
+        }
+
+        // update the read cache
+        setting_read_cache.store(values);
+        pending_changes |= changed;
+    }
+
+    xSemaphoreGive(write_mutex);
+
+    if (changes > 0)
+        notify_subscribers(changed);
+
+    staged.reset();
+    if (_changes != nullptr)
+        *_changes = changes;
+    return true;
+}
+
+static void settings::add_subscriber(const subscriber_t &_subscriber)
+{
+    xSemaphoreTake(write_mutex, portMAX_DELAY);
+
+    size_t index = nr_of_subscribers.load(std::memory_order_relaxed);
+    if (index < MAX_SUBSCRIBERS)
+    {
+        subscribers[index] = _subscriber;
+        nr_of_subscribers.store(index + 1, std::memory_order_release);
+    }
+    else
+    {
+        LOGE("Too many settings subscribers, increase MAX_SUBSCRIBERS");
+    }
+
+    xSemaphoreGive(write_mutex);
+}
+
+static void settings::notify_subscribers(const key_mask_t &_changed)
+{
+    size_t count = nr_of_subscribers.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (subscribers[i].task != nullptr && (subscribers[i].keys & _changed).any())
+            xTaskNotifyGive(subscribers[i].task);
+    }
+
+    // callbacks are run by the settings task
+    if (task_handle != nullptr)
+        xTaskNotifyGive(task_handle);
+}
+
+static void settings::task_fn(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // take all changes so far, later ones wake us up again
+        xSemaphoreTake(write_mutex, portMAX_DELAY);
+        key_mask_t changed = pending_changes;
+        pending_changes.reset();
+        xSemaphoreGive(write_mutex);
+
+        size_t count = nr_of_subscribers.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++)
+        {
+            key_mask_t relevant = subscribers[i].keys & changed;
+            if (subscribers[i].callback != nullptr && relevant.any())
+                subscribers[i].callback(relevant);
+        }
+    }
 }
@@ -0,0 +1,134 @@
+/**
+ * @file soc.cpp
+ * @author melektron
+ * @brief state of charge estimation from the cell open circuit voltage
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+#include "soc.hpp"
+#include "settings.hpp"
+
+// number of entries of the generated tables (one per percent of SoC)
+#define OCV_TABLE_SIZE 101
+
+
+namespace battery::soc  // private
+{
+    // a known point of an open circuit voltage curve
+    struct ocv_point_t
+    {
+        int soc;        // state of charge in %
+        int voltage;    // open circuit voltage in mV
+    };
+
+    /**
+     * @brief generates a table with the open circuit voltage at every percent
+     * of SoC by linearly interpolating between the given points of a curve.
+     * The points must be sorted by SoC and start at 0 % and end at 100 %.
+     *
+     * @param _points known points of the curve
+     * @return table where index i is the voltage (mV) at i % SoC
+     */
+    template <size_t N>
+    constexpr std::array<uint16_t, OCV_TABLE_SIZE> generate_ocv_table(const ocv_point_t (&_points)[N])
+    {
+        static_assert(N >= 2, "an OCV curve needs at least two points");
+        std::array<uint16_t, OCV_TABLE_SIZE> table{};
+        size_t segment = 0;
+        for (int soc = 0; soc < OCV_TABLE_SIZE; soc++)
+        {
+            while (segment + 2 < N && soc > _points[segment + 1].soc)
+                segment++;
+            const ocv_point_t &a = _points[segment];
+            const ocv_point_t &b = _points[segment + 1];
+            table[soc] = a.voltage + ((b.voltage - a.voltage) * (soc - a.soc) + (b.soc - a.soc) / 2) / (b.soc - a.soc);
+        }
+        return table;
+    }
+
+    /**
+     * @return true if the table voltages never decrease with rising SoC, 
+     * which the binary search relies on
+     */
+    constexpr bool is_monotonic(const std::array<uint16_t, OCV_TABLE_SIZE> &_table)
+    {
+        for (size_t i = 1; i < _table.size(); i++)
+            if (_table[i] < _table[i - 1])
+                return false;
+        return true;
+    }
+
+    // resting voltage curves (per cell) of the supported chemistries
+    constexpr ocv_point_t lipo_points[] = {
+        {0, 3270}, {5, 3610}, {10, 3690}, {15, 3710}, {20, 3730}, {25, 3750},
+        {30, 3770}, {35, 3790}, {40, 3800}, {45, 3820}, {50, 3840}, {55, 3850},
+        {60, 3870}, {65, 3910}, {70, 3950}, {75, 3980}, {80, 4020}, {85, 4080},
+        {90, 4110}, {95, 4150}, {100, 4200},
+    };
+    constexpr ocv_point_t li_ion_points[] = {
+        {0, 3000}, {5, 3300}, {10, 3450}, {20, 3550}, {30, 3610}, {40, 3660},
+        {50, 3710}, {60, 3780}, {70, 3860}, {80, 3950}, {90, 4050}, {100, 4200},
+    };
+    constexpr ocv_point_t lifepo4_points[] = {
+        {0, 2500}, {5, 2900}, {10, 3000}, {20, 3200}, {30, 3220}, {40, 3250},
+        {50, 3260}, {60, 3270}, {70, 3280}, {80, 3300}, {90, 3320}, {95, 3350},
+        {100, 3400},
+    };
+
+    // generated tables, constexpr so they are placed in flash
+    static constexpr std::array<uint16_t, OCV_TABLE_SIZE> ocv_tables[__CHEMISTRY_END] = {
+        generate_ocv_table(lipo_points),
+        generate_ocv_table(li_ion_points),
+        generate_ocv_table(lifepo4_points),
+    };
+    static_assert(is_monotonic(ocv_tables[LIPO]), "LiPo OCV table is not monotonic");
+    static_assert(is_monotonic(ocv_tables[LI_ION]), "Li-ion OCV table is not monotonic");
+    static_assert(is_monotonic(ocv_tables[LIFEPO4]), "LiFePO4 OCV table is not monotonic");
+};
+
+
+int battery::soc::from_voltage(int _voltage, chemistry_t _chemistry)
+{
+    if (_chemistry < 0 || _chemistry >= __CHEMISTRY_END)
+        _chemistry = LIPO;
+    const std::array<uint16_t, OCV_TABLE_SIZE> &table = ocv_tables[_chemistry];
+
+    if (_voltage <= table.front())
+        return 0;
+    if (_voltage >= table.back())
+        return 1000;
+
+    // branchless binary search for the last entry <= _voltage
+    // (the loop count only depends on the table size)
+    const uint16_t *base = table.data();
+    size_t n = table.size();
+    while (n > 1)
+    {
+        size_t half = n / 2;
+        base = (base[half] <= _voltage) ? base + half : base;
+        n -= half;
+    }
+
+    // interpolate linearly within the 1 % step
+    int index = base - table.data();
+    int lower = base[0];
+    int upper = base[1];
+    int fraction = upper > lower ? ((_voltage - lower) * 10 + (upper - lower) / 2) / (upper - lower) : 0;
+    return index * 10 + fraction;
+}
+
+int battery::soc::from_voltage(int _voltage)
+{
+    return from_voltage(
+        _voltage,
+        (chemistry_t)settings::get(settings::BATTERY_CHEMISTRY)
+    );
+}
@@ -0,0 +1,45 @@
+/**
+ * @file topology.cpp
+ * @author melektron
+ * @brief core and priority placement of all application tasks
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <sdkconfig.h>
+
+#include "topology.hpp"
+#include "log.hpp"
+
+
+// the network stack runs above the sampling priority, so it has to stay
+// on the PRO core (see topology::core_t)
+#if !defined(CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_0) || !defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0)
+#error "Wi-Fi driver and lwIP tcpip task must be pinned to the PRO core in sdkconfig"
+#endif
+
+
+TaskHandle_t topology::create_task(
+    task_t _task,
+    TaskFunction_t _fn,
+    StackType_t *_stack,
+    uint32_t _stack_size,
+    StaticTask_t *_static_buffer
+) {
+    const placement_t &placement = PLACEMENTS[_task];
+    LOGI("Starting task '%s' on core %d with priority %d", placement.name, (int)placement.core, (int)placement.priority);
+
+    return xTaskCreateStaticPinnedToCore(
+        _fn,
+        placement.name,
+        _stack_size,
+        nullptr,
+        placement.priority,
+        _stack,
+        _static_buffer,
+        placement.core
+    );
+}
@@ -0,0 +1,241 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief on-target measurement of the latency from a threshold change to
+ * the buzzer output, through the real monitoring task, alarms::evaluate()
+ * and the buzzer task, while the networking task is stuck in an HTTP request
+ * to a server that never answers (run with "pio test -e esp32dev").
+ * The board has to reach the Wi-Fi network from secrets.h, the stand-in
+ * server runs on the device itself (SERVER_HOST is 127.0.0.1 in test builds).
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <soc/gpio_periph.h>
+#include <soc/io_mux_reg.h>
+#include <lwip/sockets.h>
+
+#include "settings.hpp"
+#include "topology.hpp"
+#include "env.hpp"
+
+// number of warnings raised (and released again) while a request is stuck
+#define NR_OF_EVENTS 20
+// time between raising and releasing a warning, longer than
+// MONITOR_MIN_INTERVAL so every change gets its own monitoring cycle
+#define EVENT_PERIOD_MS 1500
+// upper bound for threshold change -> monitoring -> buzzer output. The buzzer
+// output only rises at the start of the next PWM period (~2.3 ms at A4).
+#define MAX_LATENCY_US 5000
+// how long to wait for the firmware to connect and send its first request
+#define CONNECT_TIMEOUT_MS 60000
+
+// port of the stand-in server (SERVER_PORT in net.cpp)
+#define SERVER_PORT 8080
+#define SERVER_TASK_STACK_SIZE 4096
+#define SERVER_TASK_PRIORITY 4
+#define PROBE_TASK_STACK_SIZE 2048
+#define PROBE_TASK_PRIORITY 20
+
+/**
+ * @brief starts all firmware modules and the monitoring task (main.cpp)
+ */
+void start_firmware();
+
+// number of requests the stand-in server received and is holding open
+static std::atomic<int> stuck_requests(0);
+// number of requests the stand-in server received in total
+static std::atomic<int> received_requests(0);
+
+// time the threshold change was published to the settings subscribers
+static std::atomic<int64_t> change_time_us(0);
+// time of the first rising edge of the buzzer output after the change
+static std::atomic<int64_t> buzzer_time_us(0);
+static std::atomic<bool> buzzer_armed(false);
+
+/**
+ * @brief stand-in for an unresponsive server: accepts connections and
+ * reads the requests, but never answers, so the firmware's request is
+ * blocked until its HTTP timeout
+ */
+static void server_fn(void *)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(SERVER_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    bind(listener, (struct sockaddr *)&address, sizeof(address));
+    listen(listener, 2);
+
+    for (;;)
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+            continue;
+
+        char buffer[256];
+        bool counted = false;
+        // read until the client gives up and closes the connection
+        while (recv(connection, buffer, sizeof(buffer), 0) > 0)
+        {
+            if (!counted)
+            {
+                counted = true;
+                stuck_requests++;
+                received_requests++;
+            }
+        }
+        if (counted)
+            stuck_requests--;
+        close(connection);
+    }
+}
+
+/**
+ * @brief subscribed to the warning thresholds after the monitoring task,
+ * so it is woken right after it and records when the change was published
+ */
+static void probe_fn(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        change_time_us = esp_timer_get_time();
+    }
+}
+
+/**
+ * @brief records the first rising edge of the buzzer output after arming
+ */
+static void IRAM_ATTR on_buzzer_edge(void *)
+{
+    if (buzzer_armed.exchange(false))
+        buzzer_time_us = esp_timer_get_time();
+}
+
+/**
+ * @brief sets the warning threshold of all cells, the first cell's can be
+ * above every possible voltage to raise a warning
+ */
+static void set_warning(bool _raised)
+{
+    settings::transaction t;
+    for (size_t cell = 0; cell < env::NR_OF_CELLS; cell++)
+        t.set(settings::cell_key(settings::CELL_WARN_VOLTAGE, cell), (_raised && cell == 0) ? 5000 : 0);
+    TEST_ASSERT_TRUE(t.commit());
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief raises and releases a warning by moving the threshold across the
+ * measured voltage and measures the time until the buzzer output starts,
+ * while the networking task is blocked in a request to the stand-in server
+ */
+static void test_alarm_latency_with_stuck_request()
+{
+    xTaskCreatePinnedToCore(server_fn, "stuck server", SERVER_TASK_STACK_SIZE, nullptr, SERVER_TASK_PRIORITY, nullptr, topology::PRO_CORE);
+    start_firmware();
+    // the settings of the board are restored at the end
+    const settings::snapshot_t stored = settings::get_all();
+
+    // only the warning of the first cell may change the severity, the
+    // alarms and the spread rule never trigger, a change acts immediately
+    settings::transaction t;
+    for (size_t cell = 0; cell < env::NR_OF_CELLS; cell++)
+    {
+        t.set(settings::cell_key(settings::CELL_ALARM_VOLTAGE, cell), 0);
+        t.set(settings::cell_key(settings::CELL_WARN_VOLTAGE, cell), 0);
+    }
+    t.set(settings::CELL_ALARM_VOLTAGE_DIFFERENCE, 5000);
+    t.set(settings::ALARM_HYSTERESIS, 0);
+    t.set(settings::ALARM_DEBOUNCE, 1);
+    TEST_ASSERT_TRUE(t.commit());
+
+    // the monitoring task has subscribed by now, the probe comes after it
+    vTaskDelay(pdMS_TO_TICKS(100));
+    TaskHandle_t probe_task = nullptr;
+    xTaskCreatePinnedToCore(probe_fn, "probe", PROBE_TASK_STACK_SIZE, nullptr, PROBE_TASK_PRIORITY, &probe_task, topology::PRO_CORE);
+    settings::subscribe(settings::make_cell_mask(settings::CELL_WARN_VOLTAGE), probe_task);
+
+    // watch the buzzer pin, it stays connected to the LEDC output
+    PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[env::BUZZER]);
+    gpio_set_intr_type(env::BUZZER, GPIO_INTR_POSEDGE);
+    esp_err_t err = gpio_install_isr_service(0);
+    TEST_ASSERT_TRUE(err == ESP_OK || err == ESP_ERR_INVALID_STATE);
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_isr_handler_add(env::BUZZER, on_buzzer_edge, nullptr));
+
+    // every report is flushed to the server, which never answers
+    int waited_ms = 0;
+    while (received_requests == 0 && waited_ms < CONNECT_TIMEOUT_MS)
+    {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        waited_ms += 100;
+    }
+    TEST_ASSERT_GREATER_THAN_MESSAGE(0, received_requests.load(), "firmware didn't connect to the stand-in server");
+
+    int64_t max_latency_us = 0;
+    int64_t sum_latency_us = 0;
+    int measured = 0;
+    int while_stuck = 0;
+    for (int i = 0; i < NR_OF_EVENTS; i++)
+    {
+        buzzer_time_us = 0;
+        buzzer_armed = true;
+        bool stuck = stuck_requests > 0;
+        set_warning(true);
+        vTaskDelay(pdMS_TO_TICKS(EVENT_PERIOD_MS));
+        buzzer_armed = false;
+
+        if (buzzer_time_us != 0)
+        {
+            int64_t latency = buzzer_time_us - change_time_us;
+            sum_latency_us += latency;
+            max_latency_us = latency > max_latency_us ? latency : max_latency_us;
+            measured++;
+            if (stuck)
+                while_stuck++;
+        }
+
+        set_warning(false);
+        vTaskDelay(pdMS_TO_TICKS(EVENT_PERIOD_MS));
+    }
+    gpio_isr_handler_remove(env::BUZZER);
+
+    settings::transaction restore;
+    for (size_t key = 0; key < settings::__SETTING_END; key++)
+        restore.set((settings::key_t)key, stored[(settings::key_t)key]);
+    restore.commit();
+
+    char message[160];
+    snprintf(message, sizeof(message),
+        "change -> buzzer: avg %lld us, max %lld us over %d events (%d with a stuck request, %d requests received)",
+        (long long)(sum_latency_us / (measured > 0 ? measured : 1)), (long long)max_latency_us,
+        measured, while_stuck, received_requests.load());
+    TEST_MESSAGE(message);
+
+    TEST_ASSERT_EQUAL_INT(NR_OF_EVENTS, measured);
+    TEST_ASSERT_GREATER_THAN(0, while_stuck);
+    TEST_ASSERT_LESS_THAN(MAX_LATENCY_US, max_latency_us);
+}
+
+extern "C" void app_main()
+{
+    // give the monitor time to connect
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    UNITY_BEGIN();
+    RUN_TEST(test_alarm_latency_with_stuck_request);
+    UNITY_END();
+}
@@ -0,0 +1,77 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief checks the voltage lookup table entries against the line fitting
+ * calibration they replace
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "env.hpp"
+
+/**
+ * @brief reference of the ESP32 line fitting calibration (adc_cali_line_fitting.c)
+ * for ADC1 at 11 dB attenuation with the default Vref of 1100 mV, as configured
+ * in env::init_adc()
+ */
+static int line_fitting_raw_to_voltage(int _raw)
+{
+    const uint32_t coeff_a = 1100 * 196602 / 4096;
+    const uint32_t coeff_b = 142;
+    return (int)((coeff_a * _raw + 32768) / 65536 + coeff_b);
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief every entry must be within 1 mV of the line fitting result scaled by
+ * divider ratio and correction factor (calculated in floating point), over the
+ * full raw range and the whole range of the correction setting
+ */
+static void test_lut_matches_line_fitting()
+{
+    const int corrections[] = { 5000, 9137, 10000, 10421, 15000 };
+    for (const env::cell_input_t &input : env::CELL_INPUTS)
+    {
+        for (int correction : corrections)
+        {
+            for (int raw = 0; raw < (int)env::ADC_LUT_SIZE; raw++)
+            {
+                double expected = (double)line_fitting_raw_to_voltage(raw) * input.divider_ratio *
+                    correction / env::VOLTAGE_CORRECTION_ONE;
+                uint16_t entry = env::cell_voltage_from_adc(line_fitting_raw_to_voltage(raw), input.divider_ratio, correction);
+                TEST_ASSERT_FLOAT_WITHIN(1.0f, (float)expected, (float)entry);
+            }
+        }
+    }
+}
+
+/**
+ * @brief results outside of the range of an entry saturate instead of wrapping
+ */
+static void test_lut_entries_saturate()
+{
+    TEST_ASSERT_EQUAL_UINT32(UINT16_MAX, env::cell_voltage_from_adc(3441, 3, 70000));
+    TEST_ASSERT_EQUAL_UINT32(UINT16_MAX, env::cell_voltage_from_adc(3441, 20, 15000));
+    TEST_ASSERT_EQUAL_UINT32(0, env::cell_voltage_from_adc(3441, 3, -10000));
+    TEST_ASSERT_EQUAL_UINT32(0, env::cell_voltage_from_adc(0, 3, 10000));
+
+    // largest value that still fits exactly
+    TEST_ASSERT_EQUAL_UINT32(65535, env::cell_voltage_from_adc(65535, 1, 10000));
+    TEST_ASSERT_EQUAL_UINT32(65534, env::cell_voltage_from_adc(65534, 1, 10000));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lut_matches_line_fitting);
+    RUN_TEST(test_lut_entries_saturate);
+    return UNITY_END();
+}
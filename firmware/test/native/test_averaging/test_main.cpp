@@ -0,0 +1,195 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief replays sample streams through the averaging stage
+ * (sequential_estimator and cell_array) and compares the results with
+ * a direct calculation
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+#include "sequential_estimator.hpp"
+#include "cell_array.hpp"
+
+#define MIN_SAMPLES 8
+#define MAX_SAMPLES 256
+#define BOUND_MV 2
+
+// deterministic noise source so a failing replay can be reproduced
+struct noise_t
+{
+    uint32_t state;
+
+    // uniform in [-_amplitude, _amplitude]
+    int uniform(int _amplitude)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (int)((state >> 8) % (uint32_t)(2 * _amplitude + 1)) - _amplitude;
+    }
+};
+
+/**
+ * @brief records a cell voltage stream: a quiet section, a section with
+ * large load pulses (motor noise) and a quiet section at a lower level
+ */
+static std::vector<int> record_cell(int _level, uint32_t _seed)
+{
+    noise_t noise { _seed };
+    std::vector<int> stream;
+    for (int i = 0; i < 4000; i++)
+        stream.push_back(_level + noise.uniform(2));
+    for (int i = 0; i < 4000; i++)
+        stream.push_back(_level - (i % 50 < 10 ? 300 : 0) + noise.uniform(40));
+    for (int i = 0; i < 4000; i++)
+        stream.push_back(_level - 100 + noise.uniform(2));
+    return stream;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief every completed estimate must be the rounded mean of exactly the
+ * samples it consumed, respect the sample count limits and only stop early
+ * once the confidence interval is below the bound
+ */
+static void test_estimates_match_direct_mean()
+{
+    std::vector<int> stream = record_cell(3700, 1);
+    battery::sequential_estimator estimator;
+    estimator.configure(MIN_SAMPLES, MAX_SAMPLES, BOUND_MV);
+
+    size_t start = 0;
+    size_t estimates = 0;
+    for (size_t i = 0; i < stream.size(); i++)
+    {
+        if (!estimator.add(stream[i]))
+            continue;
+
+        uint32_t count = estimator.result_count();
+        TEST_ASSERT_EQUAL_UINT32(i + 1 - start, count);
+        TEST_ASSERT_GREATER_OR_EQUAL(MIN_SAMPLES, count);
+        TEST_ASSERT_LESS_OR_EQUAL(MAX_SAMPLES, count);
+
+        double sum = 0;
+        for (size_t j = start; j <= i; j++)
+            sum += stream[j];
+        double mean = sum / count;
+        double m2 = 0;
+        for (size_t j = start; j <= i; j++)
+            m2 += (stream[j] - mean) * (stream[j] - mean);
+
+        // rounded mean, ties may go either way due to float accumulation
+        TEST_ASSERT_FLOAT_WITHIN(0.5001f, mean, estimator.result());
+
+        // stopped early, so the 95% interval (z = 2) must be within the bound
+        // (small tolerance for the float accumulation in the estimator)
+        if (count < MAX_SAMPLES)
+        {
+            double half_width = 2.0 * sqrt(m2 / (count - 1) / count);
+            TEST_ASSERT_TRUE(half_width <= BOUND_MV * 1.01);
+        }
+
+        start = i + 1;
+        estimates++;
+    }
+    TEST_ASSERT_GREATER_THAN(0, estimates);
+}
+
+/**
+ * @brief quiet signals need far less than the maximum number of samples,
+ * noisy ones use more, which is the point of the adaptive averaging
+ */
+static void test_sample_count_adapts_to_noise()
+{
+    battery::sequential_estimator quiet, noisy;
+    quiet.configure(MIN_SAMPLES, MAX_SAMPLES, BOUND_MV);
+    noisy.configure(MIN_SAMPLES, MAX_SAMPLES, BOUND_MV);
+    noise_t noise { 7 };
+
+    uint64_t quiet_samples = 0, quiet_estimates = 0;
+    uint64_t noisy_samples = 0, noisy_estimates = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        if (quiet.add(3700 + noise.uniform(1)))
+        {
+            quiet_samples += quiet.result_count();
+            quiet_estimates++;
+            TEST_ASSERT_INT_WITHIN(1, 3700, quiet.result());
+        }
+        if (noisy.add(3700 + noise.uniform(60)))
+        {
+            noisy_samples += noisy.result_count();
+            noisy_estimates++;
+            TEST_ASSERT_INT_WITHIN(10, 3700, noisy.result());
+        }
+    }
+
+    // quiet: far below the former fixed 64 samples
+    TEST_ASSERT_LESS_OR_EQUAL(16, quiet_samples / quiet_estimates);
+    // noisy (sigma ~35 mV): needs ~1200 for +-2 mV, so it hits the ceiling
+    TEST_ASSERT_EQUAL_UINT32(MAX_SAMPLES, noisy_samples / noisy_estimates);
+}
+
+/**
+ * @brief replays an interleaved two cell recording (as produced by the
+ * conversion pattern) through cell_array and checks the published averages
+ * and the time aligned spread
+ */
+static void test_cell_array_replay()
+{
+    std::vector<int> cell0 = record_cell(3700, 11);
+    std::vector<int> cell1 = record_cell(3650, 12);
+
+    static battery::cell_array<2, 16> cells;
+    cells.configure_estimators(MIN_SAMPLES, MAX_SAMPLES, BOUND_MV);
+    cells.configure_filters(0, 100);
+
+    battery::sequential_estimator reference[2];
+    for (battery::sequential_estimator &r : reference)
+        r.configure(MIN_SAMPLES, MAX_SAMPLES, BOUND_MV);
+
+    TEST_ASSERT_FALSE(cells.ready());
+    for (size_t i = 0; i < cell0.size(); i++)
+    {
+        cells.add_sample(0, cell0[i]);
+        cells.add_sample(1, cell1[i]);
+
+        // each cell must see exactly its own samples in the same order
+        if (reference[0].add(cell0[i]))
+            TEST_ASSERT_EQUAL_INT(reference[0].result(), cells.average(0));
+        if (reference[1].add(cell1[i]))
+        {
+            TEST_ASSERT_EQUAL_INT(reference[1].result(), cells.average(1));
+            TEST_ASSERT_EQUAL_UINT32(reference[1].result_count(), cells.sample_count(1));
+        }
+
+        // unfiltered (tau = 0), so this is the spread of the last scan
+        int low = cell0[i] < cell1[i] ? cell0[i] : cell1[i];
+        int high = cell0[i] < cell1[i] ? cell1[i] : cell0[i];
+        TEST_ASSERT_EQUAL_INT(high - low, cells.filtered_spread());
+    }
+    TEST_ASSERT_TRUE(cells.ready());
+
+    // end of the recording is the quiet section 100 mV lower
+    TEST_ASSERT_INT_WITHIN(1, 3600, cells.average(0));
+    TEST_ASSERT_INT_WITHIN(1, 3550, cells.average(1));
+    TEST_ASSERT_INT_WITHIN(2, 50, cells.average_spread());
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_estimates_match_direct_mean);
+    RUN_TEST(test_sample_count_adapts_to_noise);
+    RUN_TEST(test_cell_array_replay);
+    return UNITY_END();
+}
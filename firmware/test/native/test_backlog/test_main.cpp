@@ -0,0 +1,376 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief runs the flash backlog on a simulated flash partition, including
+ * reboots, a full backlog and power losses in the middle of flash operations
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+
+// the module is compiled into the test directly, so the test can look at
+// its state. Flash and NVS are simulated below.
+#include "../../../src/backlog.cpp"
+
+#define NR_OF_SECTORS 8
+#define RANDOM_ROUNDS 3000
+#define RANDOM_SEEDS 12
+
+// simulated flash: erasing sets all bits, writing can only clear bits
+static std::vector<uint8_t> flash(NR_OF_SECTORS * SECTOR_SIZE);
+static const esp_partition_t partition_info = {
+    ESP_PARTITION_TYPE_DATA,
+    PARTITION_SUBTYPE,
+    0,
+    NR_OF_SECTORS * SECTOR_SIZE,
+    SECTOR_SIZE,
+    PARTITION_LABEL,
+};
+// number of bytes that can still be written before the power is lost (-1 = never)
+static long write_budget = -1;
+
+// thrown when the simulated power is lost
+struct power_loss_t {};
+
+static std::map<std::string, uint32_t> nvs_values;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char *)
+{
+    return &partition_info;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *, size_t _offset, void *_data, size_t _size)
+{
+    memcpy(_data, &flash[_offset], _size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *, size_t _offset, const void *_data, size_t _size)
+{
+    for (size_t i = 0; i < _size; i++)
+    {
+        if (write_budget == 0)
+            throw power_loss_t();
+        if (write_budget > 0)
+            write_budget--;
+        flash[_offset + i] &= ((const uint8_t *)_data)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *, size_t _offset, size_t _size)
+{
+    if (write_budget == 0)
+        throw power_loss_t();
+    // a power loss during the erase leaves the sector partially erased
+    memset(&flash[_offset], 0xff, _size / 2);
+    if (write_budget > 0 && write_budget < 100)
+        throw power_loss_t();
+    memset(&flash[_offset], 0xff, _size);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t _crc, const uint8_t *_data, uint32_t _length)
+{
+    _crc = ~_crc;
+    while (_length--)
+    {
+        _crc ^= *_data++;
+        for (int bit = 0; bit < 8; bit++)
+            _crc = (_crc >> 1) ^ (0xedb88320 & -(_crc & 1));
+    }
+    return ~_crc;
+}
+
+esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *_handle)
+{
+    *_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t, const char *_key, uint32_t *_value)
+{
+    if (nvs_values.count(_key) == 0)
+        return ESP_ERR_NVS_NOT_FOUND;
+    *_value = nvs_values[_key];
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t, const char *_key, uint32_t _value)
+{
+    nvs_values[_key] = _value;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {}
+
+const char *esp_err_to_name(esp_err_t)
+{
+    return "error";
+}
+
+// deterministic random source so a failing run can be reproduced
+struct random_t
+{
+    uint32_t state;
+
+    uint32_t next(uint32_t _range)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) % _range;
+    }
+};
+
+/**
+ * @brief restarts the backlog as after a reset, the flash keeps its content
+ */
+static void reboot()
+{
+    write_budget = -1;
+    TEST_ASSERT_TRUE(backlog::init() == el::retcode::ok);
+}
+
+/**
+ * @brief a sample identified by its timestamp
+ */
+static net::sample_t make_sample(int _id)
+{
+    net::sample_t sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.boot = backlog::get_boot_number();
+    sample.timestamp_ms = _id;
+    return sample;
+}
+
+/**
+ * @brief reads up to _max samples from the cursor and returns their ids
+ */
+static std::vector<int> read_ids(backlog::cursor_t &_cursor, size_t _max)
+{
+    std::vector<int> ids;
+    net::sample_t sample;
+    while (ids.size() < _max && backlog::read(_cursor, sample))
+        ids.push_back((int)sample.timestamp_ms);
+    return ids;
+}
+
+/**
+ * @return std::vector<int> ids of all pending samples
+ */
+static std::vector<int> pending_ids()
+{
+    backlog::cursor_t cursor = backlog::begin();
+    std::vector<int> ids = read_ids(cursor, SIZE_MAX);
+    TEST_ASSERT_EQUAL_size_t(backlog::size(), cursor.passed);
+    return ids;
+}
+
+void setUp()
+{
+    memset(flash.data(), 0x5a, flash.size());
+    nvs_values.clear();
+    reboot();
+}
+void tearDown() {}
+
+/**
+ * @brief samples are read in the order they were pushed and consumed
+ * samples are gone
+ */
+static void test_fifo()
+{
+    for (int id = 1; id <= 100; id++)
+        TEST_ASSERT_TRUE(backlog::push(make_sample(id)) == el::retcode::ok);
+    TEST_ASSERT_EQUAL_size_t(100, backlog::size());
+
+    backlog::cursor_t cursor = backlog::begin();
+    std::vector<int> ids = read_ids(cursor, 30);
+    TEST_ASSERT_EQUAL_size_t(30, ids.size());
+    for (int i = 0; i < 30; i++)
+        TEST_ASSERT_EQUAL_INT(i + 1, ids[i]);
+    backlog::consume(cursor);
+    TEST_ASSERT_EQUAL_size_t(70, backlog::size());
+
+    ids = pending_ids();
+    TEST_ASSERT_EQUAL_size_t(70, ids.size());
+    for (int i = 0; i < 70; i++)
+        TEST_ASSERT_EQUAL_INT(i + 31, ids[i]);
+}
+
+/**
+ * @brief pending samples, partially consumed sectors and the
+ * boot number survive a reboot
+ */
+static void test_recovery_after_reboot()
+{
+    uint32_t boot = backlog::get_boot_number();
+    const int total = 3 * (int)backlog::RECORDS_PER_SECTOR + 5;
+    for (int id = 1; id <= total; id++)
+        backlog::push(make_sample(id));
+
+    // consume one and a half sectors
+    const int consumed = (int)backlog::RECORDS_PER_SECTOR + (int)backlog::RECORDS_PER_SECTOR / 2;
+    backlog::cursor_t cursor = backlog::begin();
+    read_ids(cursor, consumed);
+    backlog::consume(cursor);
+
+    reboot();
+    TEST_ASSERT_EQUAL_UINT32(boot + 1, backlog::get_boot_number());
+    TEST_ASSERT_EQUAL_size_t(total - consumed, backlog::size());
+    std::vector<int> ids = pending_ids();
+    for (size_t i = 0; i < ids.size(); i++)
+        TEST_ASSERT_EQUAL_INT(consumed + 1 + (int)i, ids[i]);
+
+    // writing continues after the recovered samples
+    backlog::push(make_sample(total + 1));
+    ids = pending_ids();
+    TEST_ASSERT_EQUAL_INT(total + 1, ids.back());
+}
+
+/**
+ * @brief a full backlog drops its oldest sector and keeps the newest samples
+ */
+static void test_full_drops_oldest()
+{
+    const int total = backlog::get_stats().capacity + 2 * (int)backlog::RECORDS_PER_SECTOR + 3;
+    for (int id = 1; id <= total; id++)
+        TEST_ASSERT_TRUE(backlog::push(make_sample(id)) == el::retcode::ok);
+
+    backlog::stats_t stats = backlog::get_stats();
+    TEST_ASSERT_GREATER_THAN(0, stats.dropped);
+    TEST_ASSERT_EQUAL_UINT32(total, stats.stored);
+    TEST_ASSERT_EQUAL_UINT32(total, stats.pending + stats.dropped);
+    // the capacity is always kept, the sector being written may hold more
+    TEST_ASSERT_GREATER_OR_EQUAL(stats.capacity, stats.pending);
+    TEST_ASSERT_LESS_THAN(stats.capacity + backlog::RECORDS_PER_SECTOR, stats.pending);
+
+    std::vector<int> ids = pending_ids();
+    TEST_ASSERT_EQUAL_size_t(stats.pending, ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+        TEST_ASSERT_EQUAL_INT(total - (int)ids.size() + 1 + (int)i, ids[i]);
+}
+
+/**
+ * @brief random pushes, uploads and reboots, with the power failing in the
+ * middle of writes and erases. Samples must stay in order, and a sample that
+ * was stored may only disappear when the backlog was full (oldest first).
+ * A power loss during consume() may cause samples to be read again, the server
+ * detects those by boot number and timestamp.
+ */
+static void test_random_operations_with_power_loss()
+{
+    for (uint32_t seed = 1; seed <= RANDOM_SEEDS; seed++)
+    {
+        random_t random { seed };
+        memset(flash.data(), 0x5a, flash.size());
+        nvs_values.clear();
+        reboot();
+
+        // samples stored and not consumed
+        std::set<int> expected;
+        int next_id = 1;
+        int exact_checks = 0;
+
+        // compares the backlog with the expected samples, after drops or power
+        // losses the model is synchronized with the backlog
+        auto check = [&](bool _exact) {
+            std::vector<int> ids = pending_ids();
+            for (size_t i = 1; i < ids.size(); i++)
+                TEST_ASSERT_GREATER_THAN(ids[i - 1], ids[i]);
+            std::set<int> found(ids.begin(), ids.end());
+            for (int id : expected)
+            {
+                // only the oldest samples may be dropped
+                if (!found.count(id))
+                    TEST_ASSERT_TRUE(ids.empty() || id < ids.front());
+            }
+            if (_exact && backlog::get_stats().dropped == 0)
+            {
+                TEST_ASSERT_TRUE(found == expected);
+                exact_checks++;
+            }
+            expected = found;
+        };
+
+        auto push = [&](int _count) {
+            for (int i = 0; i < _count; i++)
+            {
+                int id = next_id++;
+                if (backlog::push(make_sample(id)) == el::retcode::ok)
+                    expected.insert(id);
+            }
+        };
+
+        auto upload = [&](size_t _max) {
+            backlog::cursor_t cursor = backlog::begin();
+            std::vector<int> ids = read_ids(cursor, _max);
+            backlog::consume(cursor);
+            for (int id : ids)
+                expected.erase(id);
+        };
+
+        for (int round = 0; round < RANDOM_ROUNDS; round++)
+        {
+            uint32_t operation = random.next(10);
+            try
+            {
+                if (operation < 5)
+                {
+                    push(random.next(40));
+                }
+                else if (operation < 8)
+                {
+                    upload(random.next(60));
+                }
+                else if (operation < 9)
+                {
+                    write_budget = random.next(300);
+                    if (random.next(2))
+                        push(20);
+                    else
+                        upload(200);
+                    write_budget = -1;
+                }
+                else
+                {
+                    bool exact = backlog::get_stats().dropped == 0;
+                    reboot();
+                    check(exact);
+                }
+            }
+            catch (power_loss_t &)
+            {
+                reboot();
+                check(false);
+            }
+        }
+        reboot();
+        check(false);
+        TEST_ASSERT_GREATER_THAN(0, exact_checks);
+    }
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fifo);
+    RUN_TEST(test_recovery_after_reboot);
+    RUN_TEST(test_full_drops_oldest);
+    RUN_TEST(test_random_operations_with_power_loss);
+    return UNITY_END();
+}
@@ -0,0 +1,284 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief decodes the output of cbor_writer with nlohmann::json::from_cbor,
+ * decodes samples written by net::write_sample() back into sample_t like the
+ * server does and checks the sizes of the sample layouts
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "sample_encoding.hpp"
+
+// encoded size of example_sample() with 2 cells, as documented at net::sample_t
+#define EXAMPLE_CBOR_LEN 46
+#define EXAMPLE_JSON_LEN 292
+
+/**
+ * @brief decodes the written data, discarded if it isn't valid CBOR
+ */
+static nlohmann::json decode(const net::cbor_writer &_writer)
+{
+    const uint8_t *data = (const uint8_t *)_writer.data();
+    std::vector<uint8_t> bytes(data, data + _writer.size());
+    return nlohmann::json::from_cbor(bytes, true, false);
+}
+
+/**
+ * @brief reference decoding of a sample of a CBOR report (positional
+ * members), as the server has to do it
+ */
+static net::sample_t sample_from_cbor(const nlohmann::json &_array)
+{
+    net::sample_t sample;
+    sample.boot = _array.at(0).get<uint32_t>();
+    sample.timestamp_ms = _array.at(1).get<int64_t>();
+    const nlohmann::json &cells = _array.at(2);
+    TEST_ASSERT_EQUAL_size_t(env::NR_OF_CELLS, cells.size());
+    for (size_t i = 0; i < env::NR_OF_CELLS; i++)
+    {
+        net::cell_report_t &cell = sample.report.cells[i];
+        cell.voltage = cells[i].at(0).get<int>();
+        cell.warn_threshold = cells[i].at(1).get<int>();
+        cell.alarm_threshold = cells[i].at(2).get<int>();
+        cell.sample_count = cells[i].at(3).get<int>();
+        cell.soc = cells[i].at(4).get<int>();
+        cell.runtime = cells[i].at(5).get<int>();
+    }
+    sample.report.cell_spread = _array.at(3).get<int>();
+    sample.report.diff_alarm_threshold = _array.at(4).get<int>();
+    TEST_ASSERT_EQUAL_size_t(5, _array.size());
+    return sample;
+}
+
+/**
+ * @brief reference decoding of a sample of a JSON report (named members)
+ */
+static net::sample_t sample_from_json(const nlohmann::json &_object)
+{
+    net::sample_t sample;
+    sample.boot = _object.at("boot").get<uint32_t>();
+    sample.timestamp_ms = _object.at("timestamp_ms").get<int64_t>();
+    const nlohmann::json &cells = _object.at("cells");
+    TEST_ASSERT_EQUAL_size_t(env::NR_OF_CELLS, cells.size());
+    for (size_t i = 0; i < env::NR_OF_CELLS; i++)
+    {
+        net::cell_report_t &cell = sample.report.cells[i];
+        cell.voltage = cells[i].at("voltage").get<int>();
+        cell.warn_threshold = cells[i].at("warn_threshold").get<int>();
+        cell.alarm_threshold = cells[i].at("alarm_threshold").get<int>();
+        cell.sample_count = cells[i].at("sample_count").get<int>();
+        cell.soc = cells[i].at("soc").get<int>();
+        cell.runtime = cells[i].at("runtime").get<int>();
+    }
+    sample.report.cell_spread = _object.at("cell_spread").get<int>();
+    sample.report.diff_alarm_threshold = _object.at("diff_alarm_threshold").get<int>();
+    return sample;
+}
+
+static void assert_samples_equal(const net::sample_t &_expected, const net::sample_t &_actual)
+{
+    TEST_ASSERT_EQUAL_UINT32(_expected.boot, _actual.boot);
+    TEST_ASSERT_EQUAL_INT64(_expected.timestamp_ms, _actual.timestamp_ms);
+    for (size_t i = 0; i < env::NR_OF_CELLS; i++)
+    {
+        const net::cell_report_t &expected = _expected.report.cells[i];
+        const net::cell_report_t &actual = _actual.report.cells[i];
+        TEST_ASSERT_EQUAL_INT(expected.voltage, actual.voltage);
+        TEST_ASSERT_EQUAL_INT(expected.warn_threshold, actual.warn_threshold);
+        TEST_ASSERT_EQUAL_INT(expected.alarm_threshold, actual.alarm_threshold);
+        TEST_ASSERT_EQUAL_INT(expected.sample_count, actual.sample_count);
+        TEST_ASSERT_EQUAL_INT(expected.soc, actual.soc);
+        TEST_ASSERT_EQUAL_INT(expected.runtime, actual.runtime);
+    }
+    TEST_ASSERT_EQUAL_INT(_expected.report.cell_spread, _actual.report.cell_spread);
+    TEST_ASSERT_EQUAL_INT(_expected.report.diff_alarm_threshold, _actual.report.diff_alarm_threshold);
+}
+
+/**
+ * @brief the example sample of the net::sample_t documentation
+ */
+static net::sample_t example_sample()
+{
+    net::sample_t sample;
+    sample.boot = 3;
+    sample.timestamp_ms = 60000;
+    for (net::cell_report_t &cell : sample.report.cells)
+        cell = { 3700, 3000, 2800, 64, 652, -1 };
+    sample.report.cell_spread = 10;
+    sample.report.diff_alarm_threshold = 1000;
+    return sample;
+}
+
+/**
+ * @brief a sample with every value at its longest encoding
+ */
+static net::sample_t longest_sample()
+{
+    net::sample_t sample;
+    sample.boot = UINT32_MAX;
+    sample.timestamp_ms = INT64_MIN;
+    for (net::cell_report_t &cell : sample.report.cells)
+        cell = { INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN };
+    sample.report.cell_spread = INT32_MIN;
+    sample.report.diff_alarm_threshold = INT32_MIN;
+    return sample;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief integers at every encoding length boundary, negative numbers and
+ * nested containers decode to the written values
+ */
+static void test_values_round_trip()
+{
+    const int64_t values[] = {
+        0, 1, 23, 24, 255, 256, 65535, 65536, UINT32_MAX, (int64_t)UINT32_MAX + 1, INT64_MAX,
+        -1, -24, -25, -256, -257, -65536, -65537, INT32_MIN, INT64_MIN,
+    };
+
+    uint8_t buffer[512];
+    net::cbor_writer writer(buffer, sizeof(buffer));
+    writer.begin_array();
+    for (int64_t value : values)
+        writer.value(value);
+    writer.value(UINT64_MAX);
+    writer.end_array();
+    TEST_ASSERT_TRUE(writer.ok());
+
+    nlohmann::json decoded = decode(writer);
+    TEST_ASSERT_FALSE(decoded.is_discarded());
+    TEST_ASSERT_EQUAL_size_t(sizeof(values) / sizeof(values[0]) + 1, decoded.size());
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        TEST_ASSERT_TRUE(decoded[i] == values[i]);
+    TEST_ASSERT_TRUE(decoded.back() == UINT64_MAX);
+}
+
+/**
+ * @brief a report with named members and samples written by
+ * net::write_sample() decodes to the expected structure, and the samples
+ * decode back to the written values
+ */
+static void test_report_round_trip()
+{
+    net::sample_t first = example_sample();
+    net::sample_t second = longest_sample();
+
+    uint8_t buffer[512];
+    net::cbor_writer writer(buffer, sizeof(buffer));
+    writer.begin_object();
+    writer.field("uptime_ms", (int64_t)3600000);
+    writer.key("samples").begin_array();
+    net::write_sample(writer, first);
+    net::write_sample(writer, second);
+    writer.end_array();
+    writer.key("queue").begin_object().field("pushed", 12).end_object();
+    writer.end_object();
+    TEST_ASSERT_TRUE(writer.ok());
+
+    nlohmann::json decoded = decode(writer);
+    TEST_ASSERT_FALSE(decoded.is_discarded());
+    TEST_ASSERT_TRUE(decoded["uptime_ms"] == 3600000);
+    TEST_ASSERT_TRUE(decoded["queue"] == nlohmann::json({{"pushed", 12}}));
+    TEST_ASSERT_EQUAL_size_t(2, decoded["samples"].size());
+    assert_samples_equal(first, sample_from_cbor(decoded["samples"][0]));
+    assert_samples_equal(second, sample_from_cbor(decoded["samples"][1]));
+}
+
+/**
+ * @brief the JSON and the CBOR encoding of a sample decode to the same values
+ */
+static void test_encodings_agree()
+{
+    net::sample_t sample = example_sample();
+    sample.report.cells[0].voltage = 3650;
+    sample.report.cells[env::NR_OF_CELLS - 1].runtime = 7200;
+
+    char json_buffer[SAMPLE_JSON_MAX_LEN];
+    net::json_writer json(json_buffer, sizeof(json_buffer));
+    net::write_sample(json, sample);
+    TEST_ASSERT_TRUE(json.ok());
+    nlohmann::json from_json = nlohmann::json::parse(json.data(), json.data() + json.size(), nullptr, false);
+    TEST_ASSERT_FALSE(from_json.is_discarded());
+
+    uint8_t cbor_buffer[SAMPLE_CBOR_MAX_LEN];
+    net::cbor_writer cbor(cbor_buffer, sizeof(cbor_buffer));
+    net::write_sample(cbor, sample);
+    TEST_ASSERT_TRUE(cbor.ok());
+    nlohmann::json from_cbor = decode(cbor);
+    TEST_ASSERT_FALSE(from_cbor.is_discarded());
+
+    assert_samples_equal(sample, sample_from_json(from_json));
+    assert_samples_equal(sample, sample_from_cbor(from_cbor));
+}
+
+/**
+ * @brief a sample with all values at their longest encoding fits into
+ * SAMPLE_CBOR_MAX_LEN and SAMPLE_JSON_MAX_LEN, the example sample has the
+ * size documented at net::sample_t
+ */
+static void test_sample_size()
+{
+    uint8_t cbor_buffer[512];
+    char json_buffer[1024];
+
+    net::cbor_writer longest_cbor(cbor_buffer, sizeof(cbor_buffer));
+    net::write_sample(longest_cbor, longest_sample());
+    TEST_ASSERT_TRUE(longest_cbor.ok());
+    TEST_ASSERT_LESS_OR_EQUAL(SAMPLE_CBOR_MAX_LEN, longest_cbor.size());
+
+    net::json_writer longest_json(json_buffer, sizeof(json_buffer));
+    net::write_sample(longest_json, longest_sample());
+    TEST_ASSERT_TRUE(longest_json.ok());
+    TEST_ASSERT_LESS_OR_EQUAL(SAMPLE_JSON_MAX_LEN, longest_json.size());
+
+    net::cbor_writer example_cbor(cbor_buffer, sizeof(cbor_buffer));
+    net::write_sample(example_cbor, example_sample());
+    net::json_writer example_json(json_buffer, sizeof(json_buffer));
+    net::write_sample(example_json, example_sample());
+
+    char message[96];
+    snprintf(message, sizeof(message), "sample of %d cells: %d bytes CBOR, %d bytes JSON",
+        (int)env::NR_OF_CELLS, (int)example_cbor.size(), (int)example_json.size());
+    TEST_MESSAGE(message);
+    if (env::NR_OF_CELLS == 2)
+    {
+        TEST_ASSERT_EQUAL_size_t(EXAMPLE_CBOR_LEN, example_cbor.size());
+        TEST_ASSERT_EQUAL_size_t(EXAMPLE_JSON_LEN, example_json.size());
+    }
+}
+
+/**
+ * @brief writing stops at the end of the buffer
+ */
+static void test_overflow()
+{
+    uint8_t buffer[16];
+    net::cbor_writer writer(buffer, sizeof(buffer));
+    net::write_sample(writer, example_sample());
+    TEST_ASSERT_FALSE(writer.ok());
+    TEST_ASSERT_EQUAL_size_t(sizeof(buffer), writer.size());
+    TEST_ASSERT_EQUAL_size_t(0, writer.remaining());
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_values_round_trip);
+    RUN_TEST(test_report_round_trip);
+    RUN_TEST(test_encodings_agree);
+    RUN_TEST(test_sample_size);
+    RUN_TEST(test_overflow);
+    return UNITY_END();
+}
@@ -0,0 +1,156 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief replays load pulse traces through cell_array and checks that the
+ * cell spread is calculated from time aligned samples only
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cell_array.hpp"
+
+// conversion period of the ADC (20 kHz shared by two cells)
+#define CONVERSION_PERIOD_US 50
+#define CELL0_MV 3700
+#define CELL1_MV 3650
+// motor load pulses: both cells sag by the same amount at the same time
+#define PULSE_PERIOD_US 20000
+#define PULSE_LENGTH_US 5000
+#define PULSE_DROP_MV 400
+
+// deterministic noise source so a failing replay can be reproduced
+struct noise_t
+{
+    uint32_t state;
+
+    // uniform in [-_amplitude, _amplitude]
+    int uniform(int _amplitude)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (int)((state >> 8) % (uint32_t)(2 * _amplitude + 1)) - _amplitude;
+    }
+};
+
+// voltage of a cell at time _t_us of the load pulse trace
+static int trace_voltage(int _level, int64_t _t_us, noise_t &_noise)
+{
+    bool pulse = _t_us % PULSE_PERIOD_US < PULSE_LENGTH_US;
+    return _level - (pulse ? PULSE_DROP_MV : 0) + _noise.uniform(3);
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief the averaged spread must stay at the real difference of the cells
+ * even though the cell voltages themselves jump by 400 mV. Only scans that
+ * straddle a pulse edge (one per edge) may be off.
+ */
+static void test_spread_ignores_load_pulses()
+{
+    static battery::cell_array<2, 16> cells;
+    cells.configure_estimators(8, 256, 2);
+    cells.configure_filters(0, CONVERSION_PERIOD_US * 2);
+    noise_t noise { 3 };
+
+    int outliers = 0;
+    int naive_error = 0;
+    int64_t t_us = 0;
+    for (int scan = 0; scan < 100000; scan++)
+    {
+        cells.add_sample(0, trace_voltage(CELL0_MV, t_us, noise));
+        t_us += CONVERSION_PERIOD_US;
+        cells.add_sample(1, trace_voltage(CELL1_MV, t_us, noise));
+        t_us += CONVERSION_PERIOD_US;
+
+        // unfiltered, so this is the spread of this scan
+        if (abs(cells.filtered_spread() - (CELL0_MV - CELL1_MV)) > 6)
+            outliers++;
+
+        int naive = cells.average(0) - cells.average(1);
+        if (cells.ready() && abs(naive - (CELL0_MV - CELL1_MV)) > naive_error)
+            naive_error = abs(naive - (CELL0_MV - CELL1_MV));
+    }
+
+    // 2 edges per pulse period
+    int pulses = (int)(t_us / PULSE_PERIOD_US);
+    TEST_ASSERT_LESS_OR_EQUAL(2 * pulses + 2, outliers);
+    TEST_ASSERT_INT_WITHIN(2, CELL0_MV - CELL1_MV, cells.average_spread());
+
+    // the averages of the cells complete independently of each other,
+    // so their difference is off by a large part of the pulse depth
+    TEST_ASSERT_GREATER_THAN(PULSE_DROP_MV / 4, naive_error);
+}
+
+/**
+ * @brief samples out of scan order discard the scan
+ */
+static void test_out_of_order_samples_discard_scan()
+{
+    static battery::cell_array<3, 16> cells;
+    cells.configure_estimators(2, 2, 0);
+    cells.configure_filters(0, 150);
+
+    cells.add_sample(0, 3700);
+    cells.add_sample(1, 3650);
+    cells.add_sample(2, 3600);
+    TEST_ASSERT_EQUAL_INT(100, cells.filtered_spread());
+
+    // cell 1 missing, the scan must not be completed by cell 2
+    cells.add_sample(0, 3700);
+    cells.add_sample(2, 3000);
+    TEST_ASSERT_EQUAL_INT(100, cells.filtered_spread());
+
+    cells.add_sample(0, 3700);
+    cells.add_sample(1, 3690);
+    cells.add_sample(2, 3680);
+    TEST_ASSERT_EQUAL_INT(20, cells.filtered_spread());
+}
+
+/**
+ * @brief a gap of a whole number of scans minus the rest of the current
+ * scan keeps the cell order intact, so only reset_scan() (called by the
+ * sampling task on read errors and DMA overruns) prevents samples from
+ * different times being combined
+ */
+static void test_gap_resets_scan()
+{
+    static battery::cell_array<2, 16> cells;
+    cells.configure_estimators(2, 2, 0);
+    cells.configure_filters(0, 100);
+
+    cells.add_sample(0, 3700);
+    cells.add_sample(1, 3650);
+    TEST_ASSERT_EQUAL_INT(50, cells.filtered_spread());
+
+    // cell 0 at rest, then samples are lost and cell 1 is
+    // converted during a load pulse
+    cells.add_sample(0, 3700);
+    cells.reset_scan();
+    cells.add_sample(1, 3250);
+    TEST_ASSERT_EQUAL_INT(50, cells.filtered_spread());
+
+    // the next complete scan is used again
+    cells.add_sample(0, 3300);
+    cells.add_sample(1, 3250);
+    TEST_ASSERT_EQUAL_INT(50, cells.filtered_spread());
+    cells.add_sample(0, 3700);
+    cells.add_sample(1, 3660);
+    TEST_ASSERT_EQUAL_INT(40, cells.filtered_spread());
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_spread_ignores_load_pulses);
+    RUN_TEST(test_out_of_order_samples_discard_scan);
+    RUN_TEST(test_gap_resets_scan);
+    return UNITY_END();
+}
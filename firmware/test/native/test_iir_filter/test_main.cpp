@@ -0,0 +1,120 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief step response and steady state of the fixed point IIR filter
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "iir_filter.hpp"
+
+// cell sample rate of a 2 cell pack
+#define SAMPLE_PERIOD_US 100
+#define SAMPLES_PER_S (1000000 / SAMPLE_PERIOD_US)
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief applies a step from _from to _to and checks the output after one
+ * time constant (63.2%) and after it has settled (8 time constants)
+ */
+static void check_step(int _time_constant_ms, int _from, int _to)
+{
+    battery::iir_filter filter;
+    filter.configure(_time_constant_ms, SAMPLE_PERIOD_US);
+    filter.update(_from);
+
+    int64_t tau_samples = (int64_t)_time_constant_ms * SAMPLES_PER_S / 1000;
+    for (int64_t i = 0; i < tau_samples; i++)
+        filter.update(_to);
+    int expected = (int)lround(_from + (_to - _from) * (1.0 - exp(-1.0)));
+    TEST_ASSERT_INT_WITHIN(1, expected, filter.value());
+
+    for (int64_t i = tau_samples; i < 8 * tau_samples; i++)
+        filter.update(_to);
+    TEST_ASSERT_EQUAL_INT(_to, filter.value());
+}
+
+static void test_step_response_short()
+{
+    check_step(10, 3000, 3700);
+    check_step(10, 3700, 3000);
+    check_step(1000, 3000, 3700);
+    check_step(1000, 3700, 3000);
+}
+
+static void test_step_response_long()
+{
+    check_step(10000, 3000, 3700);
+    check_step(10000, 3700, 3000);
+    check_step(60000, 3000, 3700);
+    check_step(60000, 3700, 3000);
+    check_step(600000, 3000, 3700);
+    check_step(600000, 3700, 3000);
+}
+
+static void test_step_response_one_hour()
+{
+    check_step(3600000, 3000, 3700);
+    check_step(3600000, 3700, 3000);
+}
+
+/**
+ * @brief small steps must not get stuck in a dead band either
+ */
+static void test_small_step()
+{
+    check_step(3600000, 3700, 3701);
+    check_step(3600000, 3701, 3700);
+}
+
+/**
+ * @brief a noisy constant input must not drift in either direction
+ */
+static void test_steady_state_with_noise()
+{
+    battery::iir_filter filter;
+    filter.configure(60000, SAMPLE_PERIOD_US);
+    uint32_t state = 5;
+    filter.update(3700);
+    for (int i = 0; i < 20 * 60 * SAMPLES_PER_S; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        filter.update(3700 + (int)((state >> 8) % 41) - 20);
+    }
+    TEST_ASSERT_EQUAL_INT(3700, filter.value());
+}
+
+/**
+ * @brief time constant 0 passes the input through
+ */
+static void test_disabled()
+{
+    battery::iir_filter filter;
+    filter.configure(0, SAMPLE_PERIOD_US);
+    filter.update(3700);
+    filter.update(3000);
+    TEST_ASSERT_EQUAL_INT(3000, filter.value());
+    filter.update(0);
+    TEST_ASSERT_EQUAL_INT(0, filter.value());
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_step_response_short);
+    RUN_TEST(test_step_response_long);
+    RUN_TEST(test_step_response_one_hour);
+    RUN_TEST(test_small_step);
+    RUN_TEST(test_steady_state_with_noise);
+    RUN_TEST(test_disabled);
+    return UNITY_END();
+}
@@ -0,0 +1,295 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief checks reports written by json_writer by parsing them with
+ * nlohmann::json, and compares time and heap allocations per report with
+ * building and dumping an nlohmann::json DOM (as the reports were before)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <chrono>
+#include <nlohmann/json.hpp>
+
+#include "json_writer.hpp"
+
+#define NR_OF_CELLS 2
+#define SAMPLES_PER_REPORT 6
+#define REPORT_BUFFER_SIZE 8192
+
+// counts all heap allocations of the test program. Not inlined, so the
+// compiler doesn't pair the malloc() and free() with new and delete.
+static size_t allocations = 0;
+
+__attribute__((noinline)) void *operator new(size_t _size)
+{
+    allocations++;
+    void *memory = malloc(_size);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *_memory) noexcept
+{
+    free(_memory);
+}
+
+__attribute__((noinline)) void operator delete(void *_memory, size_t) noexcept
+{
+    free(_memory);
+}
+
+// same layout as net::cell_report_t and net::sample_t
+struct cell_t
+{
+    int voltage;
+    int warn_threshold;
+    int alarm_threshold;
+    int sample_count;
+    int soc;
+    int runtime;
+};
+
+struct sample_t
+{
+    uint32_t boot;
+    int64_t timestamp_ms;
+    cell_t cells[NR_OF_CELLS];
+    int cell_spread;
+    int diff_alarm_threshold;
+};
+
+static sample_t make_sample(int _index)
+{
+    sample_t sample = {};
+    sample.boot = 17;
+    sample.timestamp_ms = 1000LL * _index + 123;
+    for (int cell = 0; cell < NR_OF_CELLS; cell++)
+        sample.cells[cell] = { 3700 - 10 * cell - _index, 3000, 2800, 128 + _index, 652, -1 };
+    sample.cell_spread = 10;
+    sample.diff_alarm_threshold = 1000;
+    return sample;
+}
+
+/**
+ * @brief writes a report the way net::write_report() does
+ */
+static void write_report(net::json_writer &_writer, const sample_t *_samples, size_t _count)
+{
+    _writer.begin_object();
+    _writer.field("format", 2);
+    _writer.field("uptime_ms", (int64_t)3600000);
+    _writer.field("boot", (uint32_t)17);
+    _writer.key("samples").begin_array();
+    for (size_t i = 0; i < _count; i++)
+    {
+        const sample_t &sample = _samples[i];
+        _writer.begin_object();
+        _writer.field("boot", sample.boot);
+        _writer.field("timestamp_ms", sample.timestamp_ms);
+        _writer.key("cells").begin_array();
+        for (const cell_t &cell : sample.cells)
+        {
+            _writer.begin_object()
+                .field("voltage", cell.voltage)
+                .field("warn_threshold", cell.warn_threshold)
+                .field("alarm_threshold", cell.alarm_threshold)
+                .field("sample_count", cell.sample_count)
+                .field("soc", cell.soc)
+                .field("runtime", cell.runtime)
+                .end_object();
+        }
+        _writer.end_array();
+        _writer.field("cell_spread", sample.cell_spread);
+        _writer.field("diff_alarm_threshold", sample.diff_alarm_threshold);
+        _writer.end_object();
+    }
+    _writer.end_array();
+    _writer.key("queue").begin_object()
+        .field("pushed", (uint32_t)1234)
+        .field("dropped", (uint32_t)0)
+        .end_object();
+    _writer.end_object();
+}
+
+/**
+ * @brief builds the same report as an nlohmann::json DOM
+ */
+static nlohmann::json build_report(const sample_t *_samples, size_t _count)
+{
+    nlohmann::json samples = nlohmann::json::array();
+    for (size_t i = 0; i < _count; i++)
+    {
+        const sample_t &sample = _samples[i];
+        nlohmann::json cells = nlohmann::json::array();
+        for (const cell_t &cell : sample.cells)
+        {
+            cells.push_back({
+                {"voltage", cell.voltage},
+                {"warn_threshold", cell.warn_threshold},
+                {"alarm_threshold", cell.alarm_threshold},
+                {"sample_count", cell.sample_count},
+                {"soc", cell.soc},
+                {"runtime", cell.runtime},
+            });
+        }
+        samples.push_back({
+            {"boot", sample.boot},
+            {"timestamp_ms", sample.timestamp_ms},
+            {"cells", cells},
+            {"cell_spread", sample.cell_spread},
+            {"diff_alarm_threshold", sample.diff_alarm_threshold},
+        });
+    }
+    return {
+        {"format", 2},
+        {"uptime_ms", (int64_t)3600000},
+        {"boot", (uint32_t)17},
+        {"samples", samples},
+        {"queue", {{"pushed", (uint32_t)1234}, {"dropped", (uint32_t)0}}},
+    };
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief a written report parses to the same document as the DOM
+ */
+static void test_report_round_trip()
+{
+    sample_t samples[SAMPLES_PER_REPORT];
+    for (int i = 0; i < SAMPLES_PER_REPORT; i++)
+        samples[i] = make_sample(i);
+
+    static char buffer[REPORT_BUFFER_SIZE];
+    net::json_writer writer(buffer, sizeof(buffer));
+    write_report(writer, samples, SAMPLES_PER_REPORT);
+    TEST_ASSERT_TRUE(writer.ok());
+    TEST_ASSERT_EQUAL_size_t(strlen(buffer), writer.size());
+
+    nlohmann::json parsed = nlohmann::json::parse(writer.c_str(), nullptr, false);
+    TEST_ASSERT_FALSE(parsed.is_discarded());
+    TEST_ASSERT_TRUE(parsed == build_report(samples, SAMPLES_PER_REPORT));
+}
+
+/**
+ * @brief the limits of every integer type and empty containers survive
+ * the round trip
+ */
+static void test_extreme_values()
+{
+    char buffer[512];
+    net::json_writer writer(buffer, sizeof(buffer));
+    writer.begin_object()
+        .field("i32_min", INT32_MIN)
+        .field("i32_max", INT32_MAX)
+        .field("i64_min", INT64_MIN)
+        .field("i64_max", INT64_MAX)
+        .field("u32_max", UINT32_MAX)
+        .field("u64_max", UINT64_MAX)
+        .field("zero", 0)
+        .key("empty_array").begin_array().end_array()
+        .key("empty_object").begin_object().end_object()
+        .key("nested").begin_array().begin_array().value(-1).end_array().begin_array().end_array().end_array()
+        .end_object();
+    TEST_ASSERT_TRUE(writer.ok());
+
+    nlohmann::json parsed = nlohmann::json::parse(writer.c_str(), nullptr, false);
+    TEST_ASSERT_FALSE(parsed.is_discarded());
+    TEST_ASSERT_TRUE(parsed["i32_min"] == INT32_MIN);
+    TEST_ASSERT_TRUE(parsed["i32_max"] == INT32_MAX);
+    TEST_ASSERT_TRUE(parsed["i64_min"] == INT64_MIN);
+    TEST_ASSERT_TRUE(parsed["i64_max"] == INT64_MAX);
+    TEST_ASSERT_TRUE(parsed["u32_max"] == UINT32_MAX);
+    TEST_ASSERT_TRUE(parsed["u64_max"] == UINT64_MAX);
+    TEST_ASSERT_TRUE(parsed["zero"] == 0);
+    TEST_ASSERT_TRUE(parsed["empty_array"] == nlohmann::json::array());
+    TEST_ASSERT_TRUE(parsed["empty_object"] == nlohmann::json::object());
+    TEST_ASSERT_TRUE(parsed["nested"] == nlohmann::json::parse("[[-1],[]]"));
+}
+
+/**
+ * @brief a report that doesn't fit is cut off, stays null terminated
+ * and is reported as not ok
+ */
+static void test_overflow()
+{
+    sample_t samples[SAMPLES_PER_REPORT];
+    for (int i = 0; i < SAMPLES_PER_REPORT; i++)
+        samples[i] = make_sample(i);
+
+    char buffer[200];
+    memset(buffer, 'x', sizeof(buffer));
+    net::json_writer writer(buffer, sizeof(buffer));
+    write_report(writer, samples, SAMPLES_PER_REPORT);
+    TEST_ASSERT_FALSE(writer.ok());
+    TEST_ASSERT_EQUAL_size_t(0, writer.remaining());
+    TEST_ASSERT_EQUAL_size_t(sizeof(buffer) - 1, writer.size());
+    TEST_ASSERT_EQUAL_size_t(writer.size(), strlen(buffer));
+}
+
+/**
+ * @brief time and allocations per report of json_writer compared with
+ * building and dumping a DOM. The writer must not allocate at all.
+ */
+static void test_report_benchmark()
+{
+    const int iterations = 20000;
+    sample_t samples[SAMPLES_PER_REPORT];
+    for (int i = 0; i < SAMPLES_PER_REPORT; i++)
+        samples[i] = make_sample(i);
+    static char buffer[REPORT_BUFFER_SIZE];
+    volatile size_t sink = 0;
+
+    size_t start_allocations = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        net::json_writer writer(buffer, sizeof(buffer));
+        write_report(writer, samples, SAMPLES_PER_REPORT);
+        sink = sink + writer.size();
+    }
+    auto writer_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    size_t writer_allocations = allocations - start_allocations;
+
+    start_allocations = allocations;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        std::string text = build_report(samples, SAMPLES_PER_REPORT).dump();
+        sink = sink + text.size();
+    }
+    auto dom_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    size_t dom_allocations = allocations - start_allocations;
+
+    TEST_ASSERT_EQUAL_size_t(0, writer_allocations);
+
+    char message[160];
+    snprintf(message, sizeof(message),
+        "report of %d samples: json_writer %.0f ns, %.1f allocations, nlohmann DOM + dump %.0f ns, %.1f allocations",
+        SAMPLES_PER_REPORT,
+        (double)writer_ns / iterations, (double)writer_allocations / iterations,
+        (double)dom_ns / iterations, (double)dom_allocations / iterations);
+    TEST_MESSAGE(message);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_report_round_trip);
+    RUN_TEST(test_extreme_values);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_report_benchmark);
+    return UNITY_END();
+}
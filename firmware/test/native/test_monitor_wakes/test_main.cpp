@@ -0,0 +1,166 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief simulates the monitoring schedule (adaptive interval, threshold
+ * crossing wake-ups from the sampling task and the wake rate limit) on
+ * voltage traces and checks reaction latency and number of cycles
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <functional>
+
+#include "scheduler.hpp"
+#include "rule_engine.hpp"
+
+// the sampling task checks for crossings once per DMA frame
+#define FRAME_PERIOD_MS 25
+#define WARN_MV 3500
+#define ALARM_MV 3300
+#define HYSTERESIS_MV 50
+
+static constexpr scheduler::policy_t POLICY = {
+    .min_interval_ms = 1000,
+    .max_interval_ms = 20000,
+    .slow_margin_mv = 300,
+};
+
+struct result_t
+{
+    int cycles;         // monitoring cycles run
+    int wakes;          // crossing notifications sent by the sampling task
+    int first_alarm_ms; // time of the first cycle that saw the alarm (-1 = none)
+};
+
+/**
+ * @brief runs the monitoring task and the crossing check of the sampling task
+ * (same rules as the alarms, without debounce) against a single cell trace,
+ * in steps of one DMA frame
+ *
+ * @param _voltage_at filtered cell voltage (mV) at a time (ms)
+ * @param _duration_ms length of the simulation
+ * @param _hysteresis_mv hysteresis of the crossing rules
+ */
+static result_t simulate(std::function<int(int)> _voltage_at, int _duration_ms, int _hysteresis_mv)
+{
+    alarms::rule_engine<2> crossing_rules;
+    const alarms::rule_t rules[] = {
+        { 0, alarms::BELOW, alarms::WARNING, 1, WARN_MV, _hysteresis_mv },
+        { 0, alarms::BELOW, alarms::ALARM, 1, ALARM_MV, _hysteresis_mv },
+    };
+    crossing_rules.compile(rules, 2);
+
+    result_t result = { 0, 0, -1 };
+    uint32_t last_state = 0;
+    bool notified = false;
+    int cycle_start = 0;
+    int wake_at = 0;    // time the monitoring task's sleep ends
+    bool sleeping = false;
+
+    for (int now = 0; now < _duration_ms; now += FRAME_PERIOD_MS)
+    {
+        int voltage = _voltage_at(now);
+
+        // sampling task: crossing check after every frame
+        int32_t inputs[1] = { voltage };
+        crossing_rules.evaluate(inputs);
+        uint32_t state = (crossing_rules.is_active(0) ? 1 : 0) | (crossing_rules.is_active(1) ? 2 : 0);
+        if (state != last_state)
+        {
+            last_state = state;
+            notified = true;
+            result.wakes++;
+        }
+
+        // monitoring task: wait for the interval or a notification,
+        // then hold back until the minimum interval has passed
+        if (sleeping && notified)
+        {
+            notified = false;
+            int elapsed = now - cycle_start;
+            wake_at = now + scheduler::wake_delay(elapsed, POLICY);
+        }
+        if (sleeping && now < wake_at)
+            continue;
+
+        // cycle
+        sleeping = true;
+        notified = false;
+        cycle_start = now;
+        result.cycles++;
+        if (voltage < ALARM_MV && result.first_alarm_ms < 0)
+            result.first_alarm_ms = now;
+        wake_at = now + scheduler::next_interval(voltage - WARN_MV, POLICY);
+    }
+    return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_wake_delay()
+{
+    TEST_ASSERT_EQUAL_INT(0, scheduler::wake_delay(1000, POLICY));
+    TEST_ASSERT_EQUAL_INT(0, scheduler::wake_delay(20000, POLICY));
+    TEST_ASSERT_EQUAL_INT(975, scheduler::wake_delay(25, POLICY));
+    TEST_ASSERT_EQUAL_INT(1000, scheduler::wake_delay(0, POLICY));
+    TEST_ASSERT_EQUAL_INT(1000, scheduler::wake_delay(-5, POLICY));
+}
+
+/**
+ * @brief far from the thresholds the maximum interval is used
+ */
+static void test_idle_efficiency()
+{
+    result_t result = simulate([](int) { return 4000; }, 600000, HYSTERESIS_MV);
+    TEST_ASSERT_EQUAL_INT(0, result.wakes);
+    TEST_ASSERT_INT_WITHIN(1, 600000 / POLICY.max_interval_ms, result.cycles);
+}
+
+/**
+ * @brief a sudden drop into the alarm range during a long interval is seen
+ * by the next DMA frame and handled without waiting for the interval
+ */
+static void test_alarm_latency()
+{
+    result_t result = simulate([](int _t) { return _t < 30010 ? 4000 : 3200; }, 60000, HYSTERESIS_MV);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, result.first_alarm_ms);
+    TEST_ASSERT_LESS_OR_EQUAL(30010 + FRAME_PERIOD_MS, result.first_alarm_ms);
+    // one crossing for both thresholds, which changed in the same frame
+    TEST_ASSERT_EQUAL_INT(1, result.wakes);
+}
+
+/**
+ * @brief a value flapping around the warning threshold (+-10 mV every frame)
+ * must not wake the monitoring task every frame
+ */
+static void test_flapping_value()
+{
+    auto flapping = [](int _t) { return WARN_MV + ((_t / FRAME_PERIOD_MS) % 2 ? 10 : -10); };
+
+    // the hysteresis of the crossing rules keeps the warning active
+    result_t result = simulate(flapping, 600000, HYSTERESIS_MV);
+    TEST_ASSERT_EQUAL_INT(1, result.wakes);
+    TEST_ASSERT_LESS_OR_EQUAL(600000 / POLICY.min_interval_ms + 1, result.cycles);
+
+    // without hysteresis every frame is a crossing, the rate
+    // limit still keeps the cycles at the minimum interval
+    result = simulate(flapping, 600000, 0);
+    TEST_ASSERT_GREATER_THAN(10000, result.wakes);
+    TEST_ASSERT_LESS_OR_EQUAL(600000 / POLICY.min_interval_ms + 1, result.cycles);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_wake_delay);
+    RUN_TEST(test_idle_efficiency);
+    RUN_TEST(test_alarm_latency);
+    RUN_TEST(test_flapping_value);
+    return UNITY_END();
+}
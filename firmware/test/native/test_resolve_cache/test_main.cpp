@@ -0,0 +1,170 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief checks the server address cache with a stand-in resolver
+ * (hits, expiry, background refresh and failing resolutions)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+
+#include "resolve_cache.hpp"
+
+#define HOST "server.local"
+#define TTL_US 600000000LL
+#define MARGIN_US 60000000LL
+#define ADDRESS_A 0x0a00a8c0u   // 192.168.0.10
+#define ADDRESS_B 0x0b00a8c0u   // 192.168.0.11
+
+// behaviour of the stand-in resolver
+static bool resolver_succeeds;
+static uint32_t resolver_address;
+static int resolver_calls;
+
+static bool fake_resolver(const char *_host, uint32_t &_address)
+{
+    resolver_calls++;
+    TEST_ASSERT_EQUAL_STRING(HOST, _host);
+    if (!resolver_succeeds)
+        return false;
+    _address = resolver_address;
+    return true;
+}
+
+void setUp()
+{
+    resolver_succeeds = true;
+    resolver_address = ADDRESS_A;
+    resolver_calls = 0;
+}
+void tearDown() {}
+
+/**
+ * @brief the first lookup resolves, the following ones are served from
+ * the cache until the address expires
+ */
+static void test_hits_until_expiry()
+{
+    net::resolve_cache cache(HOST, fake_resolver, TTL_US, MARGIN_US);
+    uint32_t address = 0;
+
+    TEST_ASSERT_EQUAL_INT64(-1, cache.time_until_refresh(0));
+    TEST_ASSERT_TRUE(cache.lookup(0, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_A, address);
+    TEST_ASSERT_EQUAL_INT(1, resolver_calls);
+
+    resolver_address = ADDRESS_B;
+    for (int64_t t = 1000000; t < TTL_US; t += 1000000)
+    {
+        TEST_ASSERT_TRUE(cache.lookup(t, address));
+        TEST_ASSERT_EQUAL_HEX32(ADDRESS_A, address);
+    }
+    TEST_ASSERT_EQUAL_INT(1, resolver_calls);
+    TEST_ASSERT_EQUAL_UINT32(1, cache.misses);
+    TEST_ASSERT_EQUAL_UINT32(TTL_US / 1000000 - 1, cache.hits);
+
+    // expired, resolved again
+    TEST_ASSERT_TRUE(cache.lookup(TTL_US, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_B, address);
+    TEST_ASSERT_EQUAL_INT(2, resolver_calls);
+    TEST_ASSERT_EQUAL_UINT32(2, cache.misses);
+}
+
+/**
+ * @brief the refresh is due the margin before expiry and a successful
+ * refresh extends the address, so lookups never have to resolve
+ */
+static void test_refresh_before_expiry()
+{
+    net::resolve_cache cache(HOST, fake_resolver, TTL_US, MARGIN_US);
+    uint32_t address = 0;
+
+    TEST_ASSERT_TRUE(cache.lookup(0, address));
+    TEST_ASSERT_EQUAL_INT64(TTL_US - MARGIN_US, cache.time_until_refresh(0));
+    TEST_ASSERT_EQUAL_INT64(0, cache.time_until_refresh(TTL_US - MARGIN_US));
+
+    resolver_address = ADDRESS_B;
+    TEST_ASSERT_TRUE(cache.refresh(TTL_US - MARGIN_US));
+    TEST_ASSERT_EQUAL_INT64(TTL_US - MARGIN_US, cache.time_until_refresh(TTL_US - MARGIN_US));
+
+    // past the first expiry, but refreshed, so still a hit
+    TEST_ASSERT_TRUE(cache.lookup(TTL_US + 1, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_B, address);
+    TEST_ASSERT_EQUAL_UINT32(1, cache.misses);
+    TEST_ASSERT_EQUAL_UINT32(1, cache.hits);
+}
+
+/**
+ * @brief a failing refresh keeps the old address until it expires and is
+ * retried a quarter of the margin later, after expiry lookups fail
+ */
+static void test_failing_refresh()
+{
+    net::resolve_cache cache(HOST, fake_resolver, TTL_US, MARGIN_US);
+    uint32_t address = 0;
+
+    TEST_ASSERT_TRUE(cache.lookup(0, address));
+    resolver_succeeds = false;
+
+    int64_t now = TTL_US - MARGIN_US;
+    TEST_ASSERT_FALSE(cache.refresh(now));
+    TEST_ASSERT_EQUAL_UINT32(1, cache.failures);
+    TEST_ASSERT_EQUAL_INT64(MARGIN_US / 4, cache.time_until_refresh(now));
+
+    // the old address is still used
+    TEST_ASSERT_TRUE(cache.lookup(now + 1, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_A, address);
+
+    // expired and the resolver still fails
+    TEST_ASSERT_EQUAL_INT64(-1, cache.time_until_refresh(TTL_US));
+    TEST_ASSERT_FALSE(cache.lookup(TTL_US, address));
+    TEST_ASSERT_EQUAL_UINT32(2, cache.failures);
+
+    // recovers once the resolver works again
+    resolver_succeeds = true;
+    resolver_address = ADDRESS_B;
+    TEST_ASSERT_TRUE(cache.lookup(TTL_US + 1, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_B, address);
+}
+
+/**
+ * @brief an invalidated address is resolved again on the next lookup,
+ * a failing first resolution is not cached
+ */
+static void test_invalidate_and_initial_failure()
+{
+    net::resolve_cache cache(HOST, fake_resolver, TTL_US, MARGIN_US);
+    uint32_t address = 0;
+
+    resolver_succeeds = false;
+    TEST_ASSERT_FALSE(cache.lookup(0, address));
+    TEST_ASSERT_FALSE(cache.lookup(1, address));
+    TEST_ASSERT_EQUAL_INT(2, resolver_calls);
+    TEST_ASSERT_EQUAL_INT64(-1, cache.time_until_refresh(1));
+
+    resolver_succeeds = true;
+    TEST_ASSERT_TRUE(cache.lookup(2, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_A, address);
+
+    cache.invalidate();
+    TEST_ASSERT_EQUAL_INT64(-1, cache.time_until_refresh(3));
+    resolver_address = ADDRESS_B;
+    TEST_ASSERT_TRUE(cache.lookup(3, address));
+    TEST_ASSERT_EQUAL_HEX32(ADDRESS_B, address);
+    TEST_ASSERT_EQUAL_INT(4, resolver_calls);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hits_until_expiry);
+    RUN_TEST(test_refresh_before_expiry);
+    RUN_TEST(test_failing_refresh);
+    RUN_TEST(test_invalidate_and_initial_failure);
+    return UNITY_END();
+}
@@ -0,0 +1,182 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief replays voltage traces through the rule engine and checks
+ * hysteresis and debounce cycle by cycle
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "rule_engine.hpp"
+
+using namespace alarms;
+
+#define WARN_MV 3500
+#define ALARM_MV 3300
+#define SPREAD_MV 200
+
+/**
+ * @brief a trace step: inputs of one evaluation and the expected severity
+ */
+struct step_t
+{
+    int32_t cell;
+    int32_t spread;
+    severity_t expected;
+};
+
+/**
+ * @brief evaluates the trace and checks the severity after every step
+ */
+template <size_t N>
+static void replay(rule_engine<4> &_engine, const step_t (&_trace)[N])
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        int32_t inputs[2] = { _trace[i].cell, _trace[i].spread };
+        char message[48];
+        snprintf(message, sizeof(message), "trace step %d", (int)i);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(_trace[i].expected, _engine.evaluate(inputs), message);
+    }
+}
+
+/**
+ * @brief the rule table of the firmware for one cell
+ */
+static void compile(rule_engine<4> &_engine, uint8_t _debounce, int32_t _hysteresis)
+{
+    const rule_t rules[] = {
+        { 0, BELOW, WARNING, _debounce, WARN_MV, _hysteresis },
+        { 0, BELOW, ALARM, _debounce, ALARM_MV, _hysteresis },
+        { 1, ABOVE, ALARM, _debounce, SPREAD_MV, _hysteresis },
+    };
+    _engine.compile(rules, 3);
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief a rule triggers below the threshold and is only released once the
+ * value is back at threshold + hysteresis
+ */
+static void test_hysteresis()
+{
+    rule_engine<4> engine;
+    compile(engine, 1, 50);
+
+    const step_t trace[] = {
+        { 3600, 0, NONE },
+        { 3500, 0, NONE },      // at the threshold is not below
+        { 3499, 0, WARNING },
+        { 3520, 0, WARNING },   // within the band
+        { 3549, 0, WARNING },
+        { 3550, 0, NONE },      // moved back by the hysteresis
+        { 3510, 0, NONE },      // inactive again, threshold applies
+        { 3290, 0, ALARM },     // both cell rules at once
+        { 3340, 0, ALARM },
+        { 3351, 0, WARNING },   // alarm released, warning holds
+        { 3560, 0, NONE },
+        { 3560, 201, ALARM },   // spread rule (ABOVE)
+        { 3560, 160, ALARM },
+        { 3560, 149, NONE },
+    };
+    replay(engine, trace);
+}
+
+/**
+ * @brief a rule needs debounce consecutive evaluations to change its
+ * state, an evaluation that agrees with the state restarts the count
+ */
+static void test_debounce()
+{
+    rule_engine<4> engine;
+    compile(engine, 3, 0);
+
+    const step_t trace[] = {
+        { 3400, 0, NONE },
+        { 3400, 0, NONE },
+        { 3600, 0, NONE },      // restarts the count
+        { 3400, 0, NONE },
+        { 3400, 0, NONE },
+        { 3400, 0, WARNING },   // third in a row
+        { 3600, 0, WARNING },
+        { 3600, 0, WARNING },
+        { 3400, 0, WARNING },   // restarts the release count
+        { 3600, 0, WARNING },
+        { 3600, 0, WARNING },
+        { 3600, 0, NONE },
+    };
+    replay(engine, trace);
+}
+
+/**
+ * @brief noise around a threshold: with hysteresis the state changes once,
+ * without both hysteresis and debounce it would follow every sample
+ */
+static void test_noisy_threshold()
+{
+    rule_engine<4> engine;
+    compile(engine, 2, 50);
+
+    int changes = 0;
+    severity_t last = NONE;
+    uint32_t state = 1;
+    for (int i = 0; i < 10000; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        int32_t inputs[2] = { WARN_MV - 20 + (int32_t)((state >> 8) % 41), 0 };
+        severity_t severity = engine.evaluate(inputs);
+        if (severity != last)
+            changes++;
+        last = severity;
+    }
+    TEST_ASSERT_EQUAL_INT(1, changes);
+    TEST_ASSERT_EQUAL_INT(WARNING, last);
+}
+
+/**
+ * @brief recompiling (e.g. after a settings change) keeps the state of
+ * rules that stay at their position
+ */
+static void test_recompile_keeps_state()
+{
+    rule_engine<4> engine;
+    compile(engine, 1, 50);
+
+    const step_t trigger[] = { { 3400, 0, WARNING } };
+    replay(engine, trigger);
+
+    // hysteresis raised while active, the new release level applies
+    compile(engine, 1, 200);
+    TEST_ASSERT_TRUE(engine.is_active(0));
+    const step_t trace[] = {
+        { 3699, 0, WARNING },
+        { 3700, 0, NONE },
+    };
+    replay(engine, trace);
+
+    // rules dropped from the table are reset
+    compile(engine, 1, 0);
+    replay(engine, trigger);
+    engine.compile(nullptr, 0);
+    TEST_ASSERT_FALSE(engine.is_active(0));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hysteresis);
+    RUN_TEST(test_debounce);
+    RUN_TEST(test_noisy_threshold);
+    RUN_TEST(test_recompile_keeps_state);
+    return UNITY_END();
+}
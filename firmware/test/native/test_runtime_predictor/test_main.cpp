@@ -0,0 +1,149 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief compares the incremental sliding window fit of runtime_predictor
+ * with a direct least squares fit of the same window
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <math.h>
+#include <deque>
+
+#include "runtime_predictor.hpp"
+
+// deterministic noise source so a failing run can be reproduced
+struct noise_t
+{
+    uint32_t state;
+
+    // uniform in [-_amplitude, _amplitude]
+    int uniform(int _amplitude)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (int)((state >> 8) % (uint32_t)(2 * _amplitude + 1)) - _amplitude;
+    }
+};
+
+/**
+ * @brief reference: ordinary least squares fit of the window (oldest sample
+ * at x = 0) in floating point, extrapolated from the newest sample
+ *
+ * @return double sample periods until the threshold, 0 if already reached,
+ * -1 if not falling (same convention as samples_until())
+ */
+static double reference_samples_until(const std::deque<int> &_window, int _threshold)
+{
+    double m = _window.size();
+    double mean_x = (m - 1) / 2;
+    double mean_y = 0;
+    for (int y : _window)
+        mean_y += y;
+    mean_y /= m;
+
+    double sxy = 0, sxx = 0;
+    for (size_t x = 0; x < _window.size(); x++)
+    {
+        sxy += (x - mean_x) * (_window[x] - mean_y);
+        sxx += (x - mean_x) * (x - mean_x);
+    }
+    double slope = sxy / sxx;
+    double fit_now = mean_y + slope * (m - 1 - mean_x);
+
+    if (fit_now <= _threshold)
+        return 0;
+    if (slope >= 0)
+        return -1;
+    return (fit_now - _threshold) / -slope;
+}
+
+/**
+ * @brief feeds a discharge curve with noise and a load step and compares
+ * every prediction with the reference after the window has wrapped many times
+ */
+template <size_t N>
+static void check_against_reference(uint32_t _seed)
+{
+    battery::runtime_predictor<N> predictor;
+    std::deque<int> window;
+    noise_t noise { _seed };
+    const int threshold = 3300;
+
+    for (int i = 0; i < 20000; i++)
+    {
+        // slow discharge, a 150 mV load step in the middle, 5 mV noise
+        int voltage = 4200 - i / 20 - (i > 10000 ? 150 : 0) + noise.uniform(5);
+        predictor.add(voltage);
+        window.push_back(voltage);
+        if (window.size() > N)
+            window.pop_front();
+
+        int32_t predicted = predictor.samples_until(threshold);
+        if (window.size() < battery::runtime_predictor<N>::MIN_SAMPLES)
+        {
+            TEST_ASSERT_EQUAL_INT(-1, predicted);
+            continue;
+        }
+
+        double expected = reference_samples_until(window, threshold);
+        if (expected < 0)
+            TEST_ASSERT_EQUAL_INT(-1, predicted);
+        else if (expected > INT32_MAX)
+            TEST_ASSERT_EQUAL_INT(INT32_MAX, predicted);
+        else
+            // integer division truncates, the reference is exact
+            TEST_ASSERT_INT_WITHIN(1, (int64_t)floor(expected), predicted);
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_small_window()
+{
+    check_against_reference<4>(1);
+    check_against_reference<16>(2);
+}
+
+static void test_runtime_window()
+{
+    // window size used by the sampling task
+    check_against_reference<256>(3);
+}
+
+static void test_exact_line()
+{
+    battery::runtime_predictor<8> predictor;
+    for (int i = 0; i < 8; i++)
+        predictor.add(4000 - 10 * i);
+    // newest is 3930, 10 mV per sample
+    TEST_ASSERT_EQUAL_INT(63, predictor.samples_until(3300));
+    TEST_ASSERT_EQUAL_INT(0, predictor.samples_until(3930));
+    TEST_ASSERT_EQUAL_INT(0, predictor.samples_until(4000));
+
+    // rising voltage (charging) has no prediction
+    predictor.reset();
+    for (int i = 0; i < 8; i++)
+        predictor.add(3500 + i);
+    TEST_ASSERT_EQUAL_INT(-1, predictor.samples_until(3300));
+
+    // flat at the threshold counts as reached
+    predictor.reset();
+    for (int i = 0; i < 8; i++)
+        predictor.add(3300);
+    TEST_ASSERT_EQUAL_INT(0, predictor.samples_until(3300));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_small_window);
+    RUN_TEST(test_runtime_window);
+    RUN_TEST(test_exact_line);
+    return UNITY_END();
+}
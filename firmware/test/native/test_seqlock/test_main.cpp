@@ -0,0 +1,168 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief stress test of the seqlock with a writer and concurrent readers
+ * checking that no torn value is ever returned
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+
+#include "seqlock.hpp"
+
+#define NR_OF_STORES 1000000
+#define NR_OF_READERS 2
+
+// a value much larger than a word, every field is derived from the
+// same counter so any mix of two stores is detected
+struct value_t
+{
+    uint32_t counter;
+    int32_t fields[31];
+    uint32_t check;
+};
+
+static value_t make_value(uint32_t _counter)
+{
+    value_t value;
+    value.counter = _counter;
+    for (size_t i = 0; i < 31; i++)
+        value.fields[i] = (int32_t)(_counter * 31 + i);
+    value.check = ~_counter;
+    return value;
+}
+
+static bool is_consistent(const value_t &_value)
+{
+    if (_value.check != ~_value.counter)
+        return false;
+    for (size_t i = 0; i < 31; i++)
+        if (_value.fields[i] != (int32_t)(_value.counter * 31 + i))
+            return false;
+    return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+/**
+ * @brief readers copy the value while the writer publishes new ones as fast
+ * as it can. Every snapshot must be consistent and the counters seen by a
+ * reader must never go backwards.
+ */
+static void test_no_torn_reads()
+{
+    static concurrency::seqlock<value_t> lock;
+    lock.store(make_value(0));
+
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> torn(0);
+    std::atomic<uint32_t> backwards(0);
+    std::atomic<uint32_t> reads(0);
+
+    std::thread readers[NR_OF_READERS];
+    for (std::thread &reader : readers)
+    {
+        reader = std::thread([&]() {
+            uint32_t last = 0;
+            uint32_t count = 0;
+            while (!done.load(std::memory_order_relaxed))
+            {
+                value_t value = lock.load();
+                if (!is_consistent(value))
+                    torn++;
+                if (value.counter < last)
+                    backwards++;
+                last = value.counter;
+                count++;
+            }
+            reads += count;
+        });
+    }
+
+    for (uint32_t i = 1; i <= NR_OF_STORES; i++)
+        lock.store(make_value(i));
+    done = true;
+    for (std::thread &reader : readers)
+        reader.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+    TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+    TEST_ASSERT_GREATER_THAN(0, reads.load());
+    TEST_ASSERT_EQUAL_UINT32(NR_OF_STORES + 1, lock.get_version());
+    TEST_ASSERT_EQUAL_UINT32(NR_OF_STORES, lock.load().counter);
+}
+
+/**
+ * @brief a member read with load_field() while the writer is running
+ * must belong to one store, also if it spans several words (retry path),
+ * and a single word member must never go backwards
+ */
+static void test_load_field()
+{
+    static concurrency::seqlock<value_t> lock;
+    lock.store(make_value(5));
+    TEST_ASSERT_EQUAL_UINT32(5, lock.load_field<uint32_t>(offsetof(value_t, counter)));
+    TEST_ASSERT_EQUAL_INT32(5 * 31 + 7, lock.load_field<int32_t>(offsetof(value_t, fields) + 7 * sizeof(int32_t)));
+    TEST_ASSERT_EQUAL_UINT32(~5u, lock.load_field<uint32_t>(offsetof(value_t, check)));
+
+    struct pair_t
+    {
+        int32_t first;
+        int32_t second;
+    };
+
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> torn(0);
+    std::thread reader([&]() {
+        uint32_t last = 0;
+        while (!done.load(std::memory_order_relaxed))
+        {
+            uint32_t counter = lock.load_field<uint32_t>(offsetof(value_t, counter));
+            if (counter < last)
+                torn++;
+            last = counter;
+            pair_t pair = lock.load_field<pair_t>(offsetof(value_t, fields) + 3 * sizeof(int32_t));
+            if (pair.second != pair.first + 1 || (pair.first - 3) % 31 != 0)
+                torn++;
+        }
+    });
+    for (uint32_t i = 6; i < NR_OF_STORES; i++)
+        lock.store(make_value(i));
+    done = true;
+    reader.join();
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+}
+
+/**
+ * @brief values that aren't a multiple of the word size round trip exactly
+ */
+static void test_odd_size_value()
+{
+    struct odd_t
+    {
+        uint8_t bytes[7];
+    };
+    concurrency::seqlock<odd_t> lock;
+    odd_t value = { { 1, 2, 3, 4, 5, 6, 7 } };
+    lock.store(value);
+    odd_t copy = lock.load();
+    TEST_ASSERT_EQUAL_MEMORY(value.bytes, copy.bytes, sizeof(value.bytes));
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_no_torn_reads);
+    RUN_TEST(test_load_field);
+    RUN_TEST(test_odd_size_value);
+    return UNITY_END();
+}
@@ -0,0 +1,135 @@
+/**
+ * @file test_main.cpp
+ * @author melektron
+ * @brief accuracy of the SoC lookup against the OCV curves it is generated
+ * from, and a benchmark of the lookup
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+
+// the module is compiled into the test directly, its
+// only dependency (the chemistry setting) is provided below
+#include "../../../src/soc.cpp"
+
+int32_t settings::get(settings::key_t)
+{
+    return battery::soc::LI_ION;
+}
+
+using namespace battery::soc;
+
+/**
+ * @brief reference: inverse of the piecewise linear curve through the
+ * given points, in floating point
+ *
+ * @return double state of charge in 0.1 %
+ */
+template <size_t N>
+static double reference_soc(const ocv_point_t (&_points)[N], int _voltage)
+{
+    if (_voltage <= _points[0].voltage)
+        return 0;
+    if (_voltage >= _points[N - 1].voltage)
+        return 1000;
+    for (size_t i = 0; i + 1 < N; i++)
+    {
+        const ocv_point_t &a = _points[i];
+        const ocv_point_t &b = _points[i + 1];
+        if (_voltage >= a.voltage && _voltage < b.voltage)
+            return 10.0 * (a.soc + (double)(b.soc - a.soc) * (_voltage - a.voltage) / (b.voltage - a.voltage));
+    }
+    return 1000;
+}
+
+/**
+ * @brief every mV of the curve must map to the SoC of the reference within
+ * 0.5 % (the table has 1 % steps with rounded voltages), and the SoC must
+ * never fall with rising voltage
+ */
+template <size_t N>
+static void check_curve(const ocv_point_t (&_points)[N], chemistry_t _chemistry)
+{
+    int last = 0;
+    for (int voltage = _points[0].voltage - 100; voltage <= _points[N - 1].voltage + 100; voltage++)
+    {
+        int soc = from_voltage(voltage, _chemistry);
+        TEST_ASSERT_FLOAT_WITHIN(5.0f, (float)reference_soc(_points, voltage), (float)soc);
+        TEST_ASSERT_GREATER_OR_EQUAL(last, soc);
+        last = soc;
+    }
+
+    // the points of the curve themselves
+    for (const ocv_point_t &point : _points)
+        TEST_ASSERT_INT_WITHIN(5, point.soc * 10, from_voltage(point.voltage, _chemistry));
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_lipo_curve()
+{
+    check_curve(lipo_points, LIPO);
+}
+
+static void test_li_ion_curve()
+{
+    check_curve(li_ion_points, LI_ION);
+}
+
+static void test_lifepo4_curve()
+{
+    check_curve(lifepo4_points, LIFEPO4);
+}
+
+static void test_clamping_and_invalid_chemistry()
+{
+    TEST_ASSERT_EQUAL_INT(0, from_voltage(0, LIPO));
+    TEST_ASSERT_EQUAL_INT(0, from_voltage(-100, LIPO));
+    TEST_ASSERT_EQUAL_INT(1000, from_voltage(5000, LIPO));
+    TEST_ASSERT_EQUAL_INT(from_voltage(3800, LIPO), from_voltage(3800, (chemistry_t)17));
+    TEST_ASSERT_EQUAL_INT(from_voltage(3800, LI_ION), from_voltage(3800));
+}
+
+/**
+ * @brief measures the lookup against a linear search through the curve
+ * points (what a straightforward implementation would do). Only reported,
+ * host timings say little about the ESP32, but the relation does.
+ */
+static void test_lookup_benchmark()
+{
+    const int iterations = 2000000;
+    volatile int sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        sink = sink + from_voltage(3270 + i % 930, LIPO);
+    auto table_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        sink = sink + (int)reference_soc(lipo_points, 3270 + i % 930);
+    auto reference_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    char message[128];
+    snprintf(message, sizeof(message), "SoC lookup: %.1f ns, linear search reference: %.1f ns",
+        (double)table_ns / iterations, (double)reference_ns / iterations);
+    TEST_MESSAGE(message);
+}
+
+int main(int, char **)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lipo_curve);
+    RUN_TEST(test_li_ion_curve);
+    RUN_TEST(test_lifepo4_curve);
+    RUN_TEST(test_clamping_and_invalid_chemistry);
+    RUN_TEST(test_lookup_benchmark);
+    return UNITY_END();
+}
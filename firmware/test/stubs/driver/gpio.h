@@ -0,0 +1,29 @@
+/**
+ * @file gpio.h
+ * @author melektron
+ * @brief minimal host stand-in for the ESP-IDF header of the same name,
+ * only declares what the modules under test use
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum
+{
+    GPIO_NUM_14 = 14,
+    GPIO_NUM_16 = 16,
+    GPIO_NUM_17 = 17,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_32 = 32,
+    GPIO_NUM_33 = 33,
+    GPIO_NUM_34 = 34,
+    GPIO_NUM_35 = 35,
+    GPIO_NUM_36 = 36,
+    GPIO_NUM_39 = 39,
+} gpio_num_t;
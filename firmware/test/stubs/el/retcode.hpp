@@ -0,0 +1,22 @@
+/**
+ * @file retcode.hpp
+ * @author melektron
+ * @brief minimal host stand-in for the el-std header of the same name (lib/el-std),
+ * only declares what the modules under test use
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+namespace el
+{
+    enum class retcode
+    {
+        ok = 0,
+        err,
+    };
+};
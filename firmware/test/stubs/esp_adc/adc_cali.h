@@ -0,0 +1,17 @@
+/**
+ * @file adc_cali.h
+ * @author melektron
+ * @brief minimal host stand-in for the ESP-IDF header of the same name,
+ * only declares what the modules under test use
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef struct adc_cali_scheme_t *adc_cali_handle_t;
@@ -0,0 +1,29 @@
+/**
+ * @file adc_continuous.h
+ * @author melektron
+ * @brief minimal host stand-in for the ESP-IDF header of the same name,
+ * only declares what the modules under test use
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum
+{
+    ADC_CHANNEL_0,
+    ADC_CHANNEL_1,
+    ADC_CHANNEL_2,
+    ADC_CHANNEL_3,
+    ADC_CHANNEL_4,
+    ADC_CHANNEL_5,
+    ADC_CHANNEL_6,
+    ADC_CHANNEL_7,
+} adc_channel_t;
+
+typedef struct adc_continuous_ctx_t *adc_continuous_handle_t;
@@ -0,0 +1,20 @@
+/**
+ * @file esp_log.h
+ * @author melektron
+ * @brief minimal host stand-in for the ESP-IDF header of the same name,
+ * only declares what the modules under test use
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright FrenchBakery (c) 2026
+ *
+ */
+
+#pragma once
+
+// log messages are discarded
+#define ESP_LOGE(tag, format, ...) ((void)0)
+#define ESP_LOGW(tag, format, ...) ((void)0)
+#define ESP_LOGI(tag, format, ...) ((void)0)
+#define ESP_LOGD(tag, format, ...) ((void)0)
+#define ESP_LOGV(tag, format, ...) ((void)0)